@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rwkv_admission.h"
+
+// Weight of a new throughput sample in the EWMA.
+#define RATE_ALPHA 0.2
+
+Admission* createAdmission(int slots, double rate) {
+    Admission* admission = (Admission*)calloc(1, sizeof(Admission));
+    if (!admission) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pthread_mutex_init(&admission->lock, NULL);
+    admission->slots = slots > 0 ? slots : 1;
+    admission->rate = rate > 0 ? rate : ADMISSION_INITIAL_RATE;
+    return admission;
+}
+
+double admissionNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Hands free slots to the front of the queue. Called with the lock held.
+static void grantWaiters(Admission* admission) {
+    while (admission->head && admission->active < admission->slots) {
+        AdmissionWaiter* waiter = admission->head;
+        admission->head = waiter->next;
+        if (!admission->head) admission->tail = NULL;
+        admission->queued_bytes -= waiter->bytes;
+        admission->active_bytes += waiter->bytes;
+        admission->active++;
+        atomic_fetch_sub_explicit(&admission->queue_depth, 1, memory_order_relaxed);
+        waiter->granted = true;
+        pthread_cond_signal(&waiter->cond);
+    }
+}
+
+static void unlinkWaiter(Admission* admission, AdmissionWaiter* waiter) {
+    AdmissionWaiter* previous = NULL;
+    for (AdmissionWaiter* w = admission->head; w; previous = w, w = w->next) {
+        if (w != waiter) continue;
+        if (previous) {
+            previous->next = w->next;
+        } else {
+            admission->head = w->next;
+        }
+        if (admission->tail == w) admission->tail = previous;
+        admission->queued_bytes -= w->bytes;
+        atomic_fetch_sub_explicit(&admission->queue_depth, 1, memory_order_relaxed);
+        return;
+    }
+}
+
+static void releaseSlot(Admission* admission, long long bytes) {
+    admission->active--;
+    admission->active_bytes -= bytes;
+    grantWaiters(admission);
+}
+
+AdmitStatus admissionAcquire(Admission* admission, long long bytes, double deadline) {
+    double now = admissionNow();
+    pthread_mutex_lock(&admission->lock);
+    double service = bytes / admission->rate;
+    bool idle = !admission->head && admission->active == 0;
+    if (deadline > 0 && !idle) {
+        // Everything queued or running has to drain through the slots first.
+        double wait = 0;
+        if (admission->head || admission->active >= admission->slots) {
+            wait = (admission->queued_bytes + admission->active_bytes) / (admission->rate * admission->slots);
+        }
+        if (now + wait + service > deadline) {
+            pthread_mutex_unlock(&admission->lock);
+            atomic_fetch_add_explicit(&admission->shed, 1, memory_order_relaxed);
+            return ADMIT_SHED;
+        }
+    }
+    if (!admission->head && admission->active < admission->slots) {
+        admission->active++;
+        admission->active_bytes += bytes;
+        pthread_mutex_unlock(&admission->lock);
+        atomic_fetch_add_explicit(&admission->admitted, 1, memory_order_relaxed);
+        return ADMIT_OK;
+    }
+
+    AdmissionWaiter waiter = {.bytes = bytes, .deadline = deadline};
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&waiter.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (admission->tail) {
+        admission->tail->next = &waiter;
+    } else {
+        admission->head = &waiter;
+    }
+    admission->tail = &waiter;
+    admission->queued_bytes += bytes;
+    atomic_fetch_add_explicit(&admission->queue_depth, 1, memory_order_relaxed);
+
+    AdmitStatus status = ADMIT_OK;
+    while (!waiter.granted) {
+        if (deadline <= 0) {
+            pthread_cond_wait(&waiter.cond, &admission->lock);
+            continue;
+        }
+        // Give up as soon as starting now would already be too late.
+        double give_up = deadline - bytes / admission->rate;
+        if (admissionNow() >= give_up) {
+            unlinkWaiter(admission, &waiter);
+            status = ADMIT_EXPIRED;
+            break;
+        }
+        struct timespec ts;
+        ts.tv_sec = (time_t)give_up;
+        ts.tv_nsec = (long)((give_up - ts.tv_sec) * 1e9);
+        pthread_cond_timedwait(&waiter.cond, &admission->lock, &ts);
+    }
+    if (status == ADMIT_OK && deadline > 0 && admissionNow() + bytes / admission->rate > deadline) {
+        releaseSlot(admission, bytes);
+        status = ADMIT_EXPIRED;
+    }
+    pthread_mutex_unlock(&admission->lock);
+    pthread_cond_destroy(&waiter.cond);
+
+    if (status == ADMIT_OK) {
+        atomic_fetch_add_explicit(&admission->admitted, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&admission->expired, 1, memory_order_relaxed);
+    }
+    return status;
+}
+
+void admissionRelease(Admission* admission, long long bytes, double deadline, double seconds) {
+    if (deadline > 0 && admissionNow() > deadline) {
+        atomic_fetch_add_explicit(&admission->late, 1, memory_order_relaxed);
+    }
+    pthread_mutex_lock(&admission->lock);
+    if (seconds > 0) {
+        admission->sample_bytes += bytes;
+        admission->sample_seconds += seconds;
+        if (admission->sample_bytes >= ADMISSION_MIN_SAMPLE_BYTES) {
+            double measured = admission->sample_bytes / admission->sample_seconds;
+            admission->rate += RATE_ALPHA * (measured - admission->rate);
+            admission->sample_bytes = 0;
+            admission->sample_seconds = 0;
+        }
+    }
+    releaseSlot(admission, bytes);
+    pthread_mutex_unlock(&admission->lock);
+}
+
+void admissionFollowed(Admission* admission, double deadline, bool expired) {
+    if (expired) {
+        atomic_fetch_add_explicit(&admission->expired, 1, memory_order_relaxed);
+    } else if (deadline > 0 && admissionNow() > deadline) {
+        atomic_fetch_add_explicit(&admission->late, 1, memory_order_relaxed);
+    }
+}
+
+double admissionRate(Admission* admission) {
+    pthread_mutex_lock(&admission->lock);
+    double rate = admission->rate;
+    pthread_mutex_unlock(&admission->lock);
+    return rate;
+}
+
+void freeAdmission(Admission* admission) {
+    if (!admission) return;
+    pthread_mutex_destroy(&admission->lock);
+    free(admission);
+}
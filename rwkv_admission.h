@@ -0,0 +1,79 @@
+#ifndef RWKV_ADMISSION_H
+#define RWKV_ADMISSION_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starting throughput estimate when the caller has not measured one.
+#define ADMISSION_INITIAL_RATE 20e6
+// Encodes shorter than this are dominated by per-request overhead, so they
+// are pooled until they add up to this many bytes and then used as one
+// throughput sample.
+#define ADMISSION_MIN_SAMPLE_BYTES 4096
+
+typedef enum {
+    ADMIT_OK,
+    ADMIT_SHED,     // rejected on arrival: could not finish before its deadline
+    ADMIT_EXPIRED,  // dropped from the queue once its deadline became unreachable
+} AdmitStatus;
+
+typedef struct AdmissionWaiter {
+    long long bytes;
+    double deadline;
+    bool granted;
+    pthread_cond_t cond;
+    struct AdmissionWaiter* next;
+} AdmissionWaiter;
+
+// Limits concurrent encodes to `slots` and queues the rest in FIFO order.
+// Service time is estimated as bytes / rate, where rate is an EWMA of the
+// measured encode throughput of one slot. A request whose deadline cannot be
+// met given the work queued ahead of it is rejected before it takes any CPU,
+// except when nothing is running or queued: shedding then would not help
+// anyone, and admitting keeps the estimate measured.
+typedef struct {
+    pthread_mutex_t lock;
+    int slots;
+    int active;
+    long long active_bytes;
+    long long queued_bytes;
+    AdmissionWaiter* head;
+    AdmissionWaiter* tail;
+    double rate;  // bytes/sec per slot
+    long long sample_bytes;  // small encodes not yet folded into rate
+    double sample_seconds;
+
+    atomic_llong admitted;
+    atomic_llong shed;
+    atomic_llong expired;
+    atomic_llong late;  // admitted but finished after the deadline
+    atomic_int queue_depth;
+} Admission;
+
+// `rate` seeds the throughput estimate, e.g. from measureEncodeRate();
+// 0 uses ADMISSION_INITIAL_RATE.
+Admission* createAdmission(int slots, double rate);
+// Blocks until a slot is free. `deadline` is on the CLOCK_MONOTONIC scale
+// used by admissionNow(); 0 means none. On ADMIT_OK the caller must call
+// admissionRelease() once the work is done.
+AdmitStatus admissionAcquire(Admission* admission, long long bytes, double deadline);
+// `seconds` is the time spent encoding; pass a negative value when the work
+// was not a representative sample (e.g. its result came from another request).
+void admissionRelease(Admission* admission, long long bytes, double deadline, double seconds);
+// Counts a request that waited on another request's encode instead of
+// taking a slot, so `expired` and `late` cover it too.
+void admissionFollowed(Admission* admission, double deadline, bool expired);
+double admissionRate(Admission* admission);
+double admissionNow(void);
+void freeAdmission(Admission* admission);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
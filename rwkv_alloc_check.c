@@ -0,0 +1,173 @@
+// Counts heap allocations per encode/decode call by wrapping the allocator
+// at link time, and fails if the zero-allocation APIs (encodeInto,
+// decodeInto) allocate once warmed up.
+//
+//   gcc -O2 -DRWKV_TOKENIZER_NO_MAIN rwkv_alloc_check.c rwkv_tokenizer.c -o rwkv_alloc_check -pthread
+//       -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+//   ./rwkv_alloc_check [vocab] [input]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "rwkv_tokenizer.h"
+
+#define WARMUP_ITERATIONS 3
+#define MEASURE_SECONDS 0.5
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static atomic_ullong alloc_count;
+static atomic_ullong alloc_bytes;
+static atomic_ullong free_count;
+
+void* __wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, count * size, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr) atomic_fetch_add_explicit(&free_count, 1, memory_order_relaxed);
+    __real_free(ptr);
+}
+
+typedef struct {
+    Tokenizer* tokenizer;
+    const char* text;
+    int text_length;
+    const int* ids;
+    int num_ids;
+    int* id_buffer;
+    char* text_buffer;
+    int text_capacity;
+} Workload;
+
+typedef void (*Operation)(Workload* work);
+
+static void runEncodeBytes(Workload* work) {
+    int num_ids;
+    free(encodeBytes(work->tokenizer, work->text, work->text_length, &num_ids));
+}
+
+static void runEncodeInto(Workload* work) {
+    encodeInto(work->tokenizer, work->text, work->text_length, work->id_buffer);
+}
+
+static void runDecodeBytes(Workload* work) {
+    int length;
+    free(decodeBytes(work->tokenizer, work->ids, work->num_ids, &length));
+}
+
+static void runDecodeInto(Workload* work) {
+    decodeInto(work->tokenizer, work->ids, work->num_ids, work->text_buffer, work->text_capacity);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns false if the operation must not allocate but did.
+static bool measure(const char* name, Operation op, Workload* work, bool zero_alloc) {
+    for (int i = 0; i < WARMUP_ITERATIONS; i++) {
+        op(work);
+    }
+    unsigned long long allocs_before = atomic_load(&alloc_count);
+    unsigned long long bytes_before = atomic_load(&alloc_bytes);
+    unsigned long long frees_before = atomic_load(&free_count);
+    long iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        op(work);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < MEASURE_SECONDS);
+    double allocs = (double)(atomic_load(&alloc_count) - allocs_before) / iterations;
+    double bytes = (double)(atomic_load(&alloc_bytes) - bytes_before) / iterations;
+    double frees = (double)(atomic_load(&free_count) - frees_before) / iterations;
+    // A free with no matching allocation still touches the heap.
+    bool ok = !zero_alloc || (allocs == 0 && frees == 0);
+    printf("%-12s %8.1f MB/s %8.2f allocs/op %8.2f frees/op %12.0f bytes/op%s\n", name,
+           (double)work->text_length * iterations / elapsed / 1e6, allocs, frees, bytes,
+           ok ? "" : "  FAIL: used the heap after warmup");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = argc > 1 ? argv[1] : "rwkv_vocab_v20230424.txt";
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+
+    Workload work;
+    memset(&work, 0, sizeof(work));
+    work.tokenizer = tokenizer;
+    if (argc > 2) {
+        FILE* file = fopen(argv[2], "rb");
+        if (!file) {
+            fprintf(stderr, "Failed to open input file: %s\n", argv[2]);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        work.text_length = (int)ftell(file);
+        fseek(file, 0, SEEK_SET);
+        char* text = (char*)malloc(work.text_length > 0 ? work.text_length : 1);
+        if (!text || fread(text, 1, work.text_length, file) != (size_t)work.text_length) {
+            fprintf(stderr, "Failed to read input file: %s\n", argv[2]);
+            return 1;
+        }
+        fclose(file);
+        work.text = text;
+    } else {
+        work.text = "The quick brown fox jumps over the lazy dog. 我们今天在这里讨论一个问题。\n";
+        work.text_length = strlen(work.text);
+    }
+
+    work.id_buffer = (int*)malloc((work.text_length > 0 ? work.text_length : 1) * sizeof(int));
+    work.ids = encodeBytes(tokenizer, work.text, work.text_length, &work.num_ids);
+    work.text_capacity = work.text_length;
+    work.text_buffer = (char*)malloc(work.text_capacity > 0 ? work.text_capacity : 1);
+    if (!work.id_buffer || !work.text_buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    if (decodeInto(tokenizer, work.ids, work.num_ids, work.text_buffer, work.text_capacity) != work.text_length) {
+        fprintf(stderr, "decodeInto did not round-trip the input\n");
+        return 1;
+    }
+
+    bool ok = true;
+    ok &= measure("encodeBytes", runEncodeBytes, &work, false);
+    ok &= measure("encodeInto", runEncodeInto, &work, true);
+    ok &= measure("decodeBytes", runDecodeBytes, &work, false);
+    ok &= measure("decodeInto", runDecodeInto, &work, true);
+
+    free((void*)work.ids);
+    free(work.id_buffer);
+    free(work.text_buffer);
+    if (argc > 2) free((void*)work.text);
+    freeTokenizer(tokenizer);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
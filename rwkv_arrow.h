@@ -0,0 +1,176 @@
+#ifndef RWKV_ARROW_H
+#define RWKV_ARROW_H
+
+// Export of TokenBatch through the Arrow C Data Interface
+// (https://arrow.apache.org/docs/format/CDataInterface.html) as a
+// large_list<uint16> array. The batch's offsets and ids buffers are handed
+// over as-is; ownership of the TokenBatch moves to the exported array and is
+// freed by its release callback.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "rwkv_tokenizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif
+
+// Shared by the list array and its child so that either can be moved out and
+// released independently; the batch is freed when both are gone.
+typedef struct {
+    atomic_int refs;
+    TokenBatch* batch;
+    const void* list_buffers[2];
+    const void* item_buffers[2];
+    struct ArrowArray item;
+    struct ArrowArray* children[1];
+} RwkvArrowArrayPrivate;
+
+typedef struct {
+    struct ArrowSchema item;
+    struct ArrowSchema* children[1];
+} RwkvArrowSchemaPrivate;
+
+static inline void rwkvArrowUnref(RwkvArrowArrayPrivate* priv) {
+    if (atomic_fetch_sub_explicit(&priv->refs, 1, memory_order_acq_rel) == 1) {
+        freeTokenBatch(priv->batch);
+        free(priv);
+    }
+}
+
+static inline void rwkvArrowReleaseItemArray(struct ArrowArray* array) {
+    RwkvArrowArrayPrivate* priv = (RwkvArrowArrayPrivate*)array->private_data;
+    array->release = NULL;
+    rwkvArrowUnref(priv);
+}
+
+static inline void rwkvArrowReleaseArray(struct ArrowArray* array) {
+    RwkvArrowArrayPrivate* priv = (RwkvArrowArrayPrivate*)array->private_data;
+    // A child that was moved out has its release cleared here and is
+    // released by whoever took it.
+    if (priv->item.release) {
+        priv->item.release(&priv->item);
+    }
+    array->release = NULL;
+    rwkvArrowUnref(priv);
+}
+
+static inline void rwkvArrowReleaseItemSchema(struct ArrowSchema* schema) {
+    schema->release = NULL;
+}
+
+static inline void rwkvArrowReleaseSchema(struct ArrowSchema* schema) {
+    RwkvArrowSchemaPrivate* priv = (RwkvArrowSchemaPrivate*)schema->private_data;
+    if (priv->item.release) {
+        priv->item.release(&priv->item);
+    }
+    free(priv);
+    schema->release = NULL;
+}
+
+// Fills `out` with the large_list<uint16> type of an exported batch.
+static inline int rwkvArrowExportSchema(struct ArrowSchema* out) {
+    RwkvArrowSchemaPrivate* priv = (RwkvArrowSchemaPrivate*)calloc(1, sizeof(RwkvArrowSchemaPrivate));
+    if (!priv) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    priv->item.format = "S";
+    priv->item.name = "item";
+    priv->item.release = rwkvArrowReleaseItemSchema;
+    priv->children[0] = &priv->item;
+
+    out->format = "+L";
+    out->name = "";
+    out->metadata = NULL;
+    out->flags = 0;
+    out->n_children = 1;
+    out->children = priv->children;
+    out->dictionary = NULL;
+    out->release = rwkvArrowReleaseSchema;
+    out->private_data = priv;
+    return 0;
+}
+
+// Moves `batch` into `out` without copying its buffers. On success the
+// caller must not touch or free `batch` again; on failure it still owns it.
+static inline int rwkvArrowExportBatch(TokenBatch* batch, struct ArrowArray* out) {
+    RwkvArrowArrayPrivate* priv = (RwkvArrowArrayPrivate*)calloc(1, sizeof(RwkvArrowArrayPrivate));
+    if (!priv) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    atomic_init(&priv->refs, 2);
+    priv->batch = batch;
+    priv->list_buffers[0] = NULL;
+    priv->list_buffers[1] = batch->offsets;
+    priv->item_buffers[0] = NULL;
+    priv->item_buffers[1] = batch->ids;
+
+    struct ArrowArray* item = &priv->item;
+    item->length = batch->offsets[batch->num_texts];
+    item->null_count = 0;
+    item->offset = 0;
+    item->n_buffers = 2;
+    item->n_children = 0;
+    item->buffers = priv->item_buffers;
+    item->children = NULL;
+    item->dictionary = NULL;
+    item->release = rwkvArrowReleaseItemArray;
+    item->private_data = priv;
+    priv->children[0] = item;
+
+    out->length = batch->num_texts;
+    out->null_count = 0;
+    out->offset = 0;
+    out->n_buffers = 2;
+    out->n_children = 1;
+    out->buffers = priv->list_buffers;
+    out->children = priv->children;
+    out->dictionary = NULL;
+    out->release = rwkvArrowReleaseArray;
+    out->private_data = priv;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+// C++20 awaitables for coroutine servers.
+//
+//   std::vector<int> ids = co_await rwkv::async_encode(tokenizer, pool, text, loop);
+//
+// Inputs below the threshold are encoded inline in await_ready(), so the
+// common small request never suspends. Larger ones run on the ThreadPool
+// and the coroutine is handed back through `executor.post(handle)`, so it
+// resumes on the event loop rather than on a pool thread. The text must stay
+// alive until the co_await completes.
+
+#ifndef RWKV_ASYNC_HPP
+#define RWKV_ASYNC_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "rwkv_tokenizer.h"
+
+namespace rwkv {
+
+// Below this many bytes (or ids) the work takes a few microseconds, less
+// than a round trip through the pool.
+inline constexpr std::size_t async_inline_threshold = 16 * 1024;
+
+// Resumes the coroutine directly on the pool thread that finished the work.
+struct inline_executor {
+    void post(std::coroutine_handle<> handle) { handle.resume(); }
+};
+
+template <class Executor>
+class encode_awaitable {
+public:
+    encode_awaitable(Tokenizer* tokenizer, ThreadPool* pool, std::string_view text, Executor& executor,
+                     std::size_t threshold)
+        : tokenizer_(tokenizer), pool_(pool), text_(text), executor_(executor), threshold_(threshold) {}
+
+    bool await_ready() {
+        if (text_.size() >= threshold_) return false;
+        run();
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        threadPoolSubmit(pool_, &encode_awaitable::task, this);
+    }
+    std::vector<int> await_resume() { return std::move(ids_); }
+
+private:
+    void run() {
+        ids_.resize(text_.size());
+        ids_.resize(encodeInto(tokenizer_, text_.data(), static_cast<int>(text_.size()), ids_.data()));
+    }
+    static void task(void* arg) {
+        encode_awaitable* self = static_cast<encode_awaitable*>(arg);
+        self->run();
+        self->executor_.post(self->handle_);
+    }
+
+    Tokenizer* tokenizer_;
+    ThreadPool* pool_;
+    std::string_view text_;
+    Executor& executor_;
+    std::size_t threshold_;
+    std::coroutine_handle<> handle_;
+    std::vector<int> ids_;
+};
+
+template <class Executor>
+class decode_awaitable {
+public:
+    decode_awaitable(const Tokenizer* tokenizer, ThreadPool* pool, const int* ids, std::size_t num_ids,
+                     Executor& executor, std::size_t threshold)
+        : tokenizer_(tokenizer), pool_(pool), ids_(ids), num_ids_(num_ids), executor_(executor), threshold_(threshold) {}
+
+    bool await_ready() {
+        if (num_ids_ >= threshold_) return false;
+        run();
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        threadPoolSubmit(pool_, &decode_awaitable::task, this);
+    }
+    // Throws std::invalid_argument on an unknown id.
+    std::string await_resume() {
+        if (!ok_) throw std::invalid_argument("unknown token id");
+        return std::move(text_);
+    }
+
+private:
+    void run() {
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < num_ids_; i++) {
+            int token_length;
+            if (!tokenBytes(tokenizer_, ids_[i], &token_length)) {
+                ok_ = false;
+                return;
+            }
+            length += token_length;
+        }
+        text_.resize(length);
+        ok_ = decodeInto(tokenizer_, ids_, static_cast<int>(num_ids_), text_.data(), static_cast<int>(length)) >= 0;
+    }
+    static void task(void* arg) {
+        decode_awaitable* self = static_cast<decode_awaitable*>(arg);
+        self->run();
+        self->executor_.post(self->handle_);
+    }
+
+    const Tokenizer* tokenizer_;
+    ThreadPool* pool_;
+    const int* ids_;
+    std::size_t num_ids_;
+    Executor& executor_;
+    std::size_t threshold_;
+    std::coroutine_handle<> handle_;
+    std::string text_;
+    bool ok_ = true;
+};
+
+template <class Executor>
+encode_awaitable<Executor> async_encode(Tokenizer* tokenizer, ThreadPool* pool, std::string_view text,
+                                        Executor& executor, std::size_t threshold = async_inline_threshold) {
+    return encode_awaitable<Executor>(tokenizer, pool, text, executor, threshold);
+}
+
+template <class Executor>
+decode_awaitable<Executor> async_decode(const Tokenizer* tokenizer, ThreadPool* pool, const int* ids,
+                                        std::size_t num_ids, Executor& executor,
+                                        std::size_t threshold = async_inline_threshold) {
+    return decode_awaitable<Executor>(tokenizer, pool, ids, num_ids, executor, threshold);
+}
+
+}  // namespace rwkv
+
+#endif
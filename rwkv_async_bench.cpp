@@ -0,0 +1,220 @@
+// Event-loop latency under mixed encode load, with every request encoded
+// inline on the loop versus through rwkv_async.hpp.
+//
+//   gcc -O2 -DRWKV_TOKENIZER_NO_MAIN -c rwkv_tokenizer.c
+//   g++ -std=c++20 -O2 rwkv_async_bench.cpp rwkv_tokenizer.o -o rwkv_async_bench -pthread
+//   ./rwkv_async_bench [vocab] [input]
+//
+// A ticker coroutine wakes every millisecond and records how late it ran
+// while client coroutines send mostly 1 KB requests with an occasional
+// 1 MB one.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rwkv_async.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static const char* builtin_sample =
+    "The quick brown fox jumps over the lazy dog. It is given that $t$ is a common root of the "
+    "following two equations, where $a,b,c,d,e$ are real numbers.\n"
+    "我们今天在这里讨论一个问题，这个问题对所有人都很重要。日本語のテキストも少し含めます。\n"
+    "    for (int i = 0; i < n; i++) { total += values[i] * weights[i]; }\n";
+
+constexpr std::size_t small_request = 1024;
+constexpr std::size_t large_request = 1 << 20;
+constexpr int large_every = 20;
+constexpr int num_clients = 4;
+constexpr auto tick = std::chrono::milliseconds(1);
+constexpr auto run_time = std::chrono::seconds(2);
+
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Single-threaded loop: coroutines resumed from other threads come back
+// through post().
+class EventLoop {
+public:
+    void post(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(handle);
+        cond_.notify_one();
+    }
+
+    auto sleep_until(Clock::time_point deadline) {
+        struct awaiter {
+            EventLoop& loop;
+            Clock::time_point deadline;
+            bool await_ready() { return Clock::now() >= deadline; }
+            void await_suspend(std::coroutine_handle<> handle) { loop.timers_.push({deadline, handle}); }
+            void await_resume() {}
+        };
+        return awaiter{*this, deadline};
+    }
+
+    auto yield() {
+        struct awaiter {
+            EventLoop& loop;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { loop.post(handle); }
+            void await_resume() {}
+        };
+        return awaiter{*this};
+    }
+
+    // Returns once `done` is set and every coroutine has finished.
+    void run(const bool& done) {
+        while (!done || running > 0) {
+            std::coroutine_handle<> next;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (ready_.empty() && (timers_.empty() || timers_.top().deadline > Clock::now())) {
+                    if (timers_.empty()) {
+                        cond_.wait(lock);
+                    } else {
+                        cond_.wait_until(lock, timers_.top().deadline);
+                    }
+                }
+                if (!timers_.empty() && timers_.top().deadline <= Clock::now()) {
+                    next = timers_.top().handle;
+                    timers_.pop();
+                } else {
+                    next = ready_.front();
+                    ready_.pop_front();
+                }
+            }
+            next.resume();
+        }
+    }
+
+    int running = 0;  // coroutines that have not finished
+
+private:
+    struct Timer {
+        Clock::time_point deadline;
+        std::coroutine_handle<> handle;
+        bool operator>(const Timer& other) const { return deadline > other.deadline; }
+    };
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+};
+
+struct Stats {
+    std::vector<double> lateness_us;
+    std::size_t bytes = 0;
+    std::size_t requests = 0;
+};
+
+static task ticker(EventLoop& loop, const bool& done, Stats& stats) {
+    loop.running++;
+    Clock::time_point deadline = Clock::now();
+    while (!done) {
+        deadline += tick;
+        co_await loop.sleep_until(deadline);
+        stats.lateness_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - deadline).count());
+        if (Clock::now() > deadline + tick) deadline = Clock::now();
+    }
+    loop.running--;
+}
+
+static task client(EventLoop& loop, Tokenizer* tokenizer, ThreadPool* pool, const std::string& data,
+                   std::size_t threshold, int seed, const bool& done, Stats& stats) {
+    loop.running++;
+    std::mt19937 rng(seed);
+    while (!done) {
+        bool large = rng() % large_every == 0;
+        std::size_t length = large ? large_request : small_request;
+        std::size_t start = rng() % (data.size() - length);
+        std::vector<int> ids = co_await rwkv::async_encode(
+            tokenizer, pool, std::string_view(data).substr(start, length), loop, threshold);
+        stats.bytes += length;
+        stats.requests++;
+        co_await loop.yield();
+    }
+    loop.running--;
+}
+
+static task stopAfter(EventLoop& loop, Clock::duration duration, bool& done) {
+    loop.running++;
+    co_await loop.sleep_until(Clock::now() + duration);
+    done = true;
+    loop.running--;
+}
+
+static double percentile(std::vector<double>& values, double p) {
+    if (values.empty()) return 0;
+    std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void runMode(const char* name, Tokenizer* tokenizer, ThreadPool* pool, const std::string& data,
+                    std::size_t threshold) {
+    EventLoop loop;
+    Stats stats;
+    bool done = false;
+    Clock::time_point start = Clock::now();
+    stopAfter(loop, run_time, done);
+    ticker(loop, done, stats);
+    for (int c = 0; c < num_clients; c++) {
+        client(loop, tokenizer, pool, data, threshold, c + 1, done, stats);
+    }
+    loop.run(done);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double max = stats.lateness_us.empty() ? 0 : *std::max_element(stats.lateness_us.begin(), stats.lateness_us.end());
+    std::printf("%-7s tick lateness p50 %8.1f us  p99 %8.1f us  max %8.1f us  | %6zu requests %7.1f MB/s\n", name,
+                percentile(stats.lateness_us, 0.5), percentile(stats.lateness_us, 0.99), max, stats.requests,
+                stats.bytes / seconds / 1e6);
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = argc > 1 ? argv[1] : "rwkv_vocab_v20230424.txt";
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+    std::string data;
+    if (argc > 2) {
+        std::ifstream file(argv[2], std::ios::binary);
+        if (!file) {
+            std::fprintf(stderr, "Failed to open input file: %s\n", argv[2]);
+            return 1;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        data = contents.str();
+    }
+    while (data.size() < 2 * large_request) data += builtin_sample;
+
+    ThreadPool* pool = createThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+    runMode("inline", tokenizer, pool, data, std::numeric_limits<std::size_t>::max());
+    runMode("async", tokenizer, pool, data, rwkv::async_inline_threshold);
+    freeThreadPool(pool);
+    freeTokenizer(tokenizer);
+    return 0;
+}
@@ -0,0 +1,290 @@
+// Encode throughput of each available matcher over the same input.
+//
+//   ./rwkv_bench [vocab] [input]
+//   ./rwkv_bench --scale [vocab] [input]
+//
+// --scale grows the vocabulary synthetically (concatenations of existing
+// tokens) to 256k, 512k and 1M entries and reports load time, tokenizer
+// memory and encode throughput at each size, then the time for a lazy load
+// (loadVocabLazy) and its first encode of a short ASCII request.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rwkv_tokenizer.h"
+
+static const char* builtin_sample =
+    "The quick brown fox jumps over the lazy dog. It is given that $t$ is a common root of the "
+    "following two equations, where $a,b,c,d,e$ are real numbers.\n"
+    "我们今天在这里讨论一个问题，这个问题对所有人都很重要。日本語のテキストも少し含めます。\n"
+    "    for (int i = 0; i < n; i++) { total += values[i] * weights[i]; }\n";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char* ascii_request = "Summarize the following paragraph in one sentence, keeping all numbers.";
+
+static const int scale_sizes[] = {262144, 524288, 1048576};
+#define SCALE_MAX_TOKEN_LENGTH 64
+
+static void bench(MatcherKind matcher, Tokenizer* tokenizer,
+                  const char* data, int length, int* out, const int* reference, int reference_count) {
+    const char* name = matcherName(matcher);
+    tokenizer->matcher = matcher;
+    int count = encodeInto(tokenizer, data, length, out);
+    if (count != reference_count || memcmp(out, reference, count * sizeof(int)) != 0) {
+        printf("%-10s output differs from trie\n", name);
+        return;
+    }
+    int iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        encodeInto(tokenizer, data, length, out);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double bytes = (double)length * iterations;
+    printf("%-10s %8.1f MB/s %8.2f Mtok/s\n", name, bytes / elapsed / 1e6, (double)count * iterations / elapsed / 1e6);
+}
+
+static char* readInput(const char* path, int* length) {
+    char* data;
+    if (path) {
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+            fprintf(stderr, "Failed to open input file: %s\n", path);
+            return NULL;
+        }
+        fseek(file, 0, SEEK_END);
+        *length = (int)ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = (char*)malloc(*length > 0 ? *length : 1);
+        if (!data || fread(data, 1, *length, file) != (size_t)*length) {
+            fprintf(stderr, "Failed to read input file: %s\n", path);
+            return NULL;
+        }
+        fclose(file);
+    } else {
+        int sample_length = strlen(builtin_sample);
+        int copies = (1 << 20) / sample_length + 1;
+        *length = sample_length * copies;
+        data = (char*)malloc(*length);
+        if (!data) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < copies; i++) {
+            memcpy(data + i * sample_length, builtin_sample, sample_length);
+        }
+    }
+    return data;
+}
+
+static bool hasToken(const TrieNode* root, const unsigned char* token, int length) {
+    const TrieNode* node = root;
+    for (int i = 0; i < length && node; i++) {
+        node = trieChild(node, token[i]);
+    }
+    return node && node->value != -1;
+}
+
+static void writeVocabLine(FILE* out, int id, const unsigned char* token, int length) {
+    fprintf(out, "%d b'", id);
+    for (int i = 0; i < length; i++) {
+        if (token[i] >= 0x20 && token[i] < 0x7F && token[i] != '\'' && token[i] != '\\') {
+            fputc(token[i], out);
+        } else {
+            fprintf(out, "\\x%02x", token[i]);
+        }
+    }
+    fprintf(out, "' %d\n", length);
+}
+
+// Writes a vocabulary of target_size tokens: the base vocabulary followed by
+// distinct concatenations of two or three base tokens, as a stand-in for
+// the long merges that dominate large BPE vocabularies.
+static int writeScaledVocab(const Tokenizer* base, int target_size, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open vocabulary file: %s\n", path);
+        return -1;
+    }
+    int* ids = (int*)malloc(base->num_tokens * sizeof(int));
+    if (!ids) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    int num_ids = 0;
+    for (int id = 0; id <= base->max_token_id; id++) {
+        int length;
+        const unsigned char* token = tokenBytes(base, id, &length);
+        if (!token || base->token_length[id] == -1) continue;
+        writeVocabLine(out, id, token, length);
+        ids[num_ids++] = id;
+    }
+
+    Tokenizer* seen = createTokenizer();
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    int next_id = base->max_token_id + 1;
+    int written = num_ids;
+    while (written < target_size) {
+        unsigned char token[SCALE_MAX_TOKEN_LENGTH];
+        int length = 0;
+        int parts = 2 + (int)(state >> 63);
+        for (int p = 0; p < parts; p++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            int part_length;
+            const unsigned char* part = tokenBytes(base, ids[state % num_ids], &part_length);
+            if (length + part_length > SCALE_MAX_TOKEN_LENGTH) break;
+            memcpy(token + length, part, part_length);
+            length += part_length;
+        }
+        if (length == 0 || hasToken(base->root, token, length) || hasToken(seen->root, token, length)) continue;
+        insertTrie(seen->root, token, length, next_id);
+        writeVocabLine(out, next_id++, token, length);
+        written++;
+    }
+    freeTokenizer(seen);
+    free(ids);
+    fclose(out);
+    return 0;
+}
+
+static double encodeThroughput(Tokenizer* tokenizer, const char* data, int length, int* out) {
+    int iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        encodeInto(tokenizer, data, length, out);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    return (double)length * iterations / elapsed / 1e6;
+}
+
+static void scaleRow(const char* path, const char* data, int length, int* out) {
+    Tokenizer* tokenizer = createTokenizer();
+    double start = now();
+    if (loadVocab(tokenizer, path) != 0) {
+        freeTokenizer(tokenizer);
+        return;
+    }
+    double load_ms = (now() - start) * 1e3;
+    size_t memory = tokenizerMemoryUsage(tokenizer);
+    printf("%8d %10.1f %10.1f %10.1f", tokenizer->num_tokens, load_ms, memory / 1e6, (double)memory / tokenizer->num_tokens);
+    for (int m = 0; m < NUM_MATCHERS; m++) {
+        if (matcherAvailable(tokenizer, (MatcherKind)m)) {
+            tokenizer->matcher = (MatcherKind)m;
+            printf("  %s %.1f MB/s", matcherName((MatcherKind)m), encodeThroughput(tokenizer, data, length, out));
+        }
+    }
+    freeTokenizer(tokenizer);
+
+    tokenizer = createTokenizer();
+    start = now();
+    loadVocabLazy(tokenizer, path);
+    load_ms = (now() - start) * 1e3;
+    start = now();
+    encodeInto(tokenizer, ascii_request, strlen(ascii_request), out);
+    double first_ms = (now() - start) * 1e3;
+    printf("  | lazy %.1f ms + first ASCII encode %.1f ms, %.1f MB\n", load_ms, first_ms, tokenizerMemoryUsage(tokenizer) / 1e6);
+    freeTokenizer(tokenizer);
+}
+
+static int scaleBench(const char* vocab, const char* input) {
+    Tokenizer* base = createTokenizer();
+    if (loadVocab(base, vocab) != 0) {
+        freeTokenizer(base);
+        return 1;
+    }
+    int length;
+    char* data = readInput(input, &length);
+    if (!data) return 1;
+    int* out = (int*)malloc((length > 0 ? length : 1) * sizeof(int));
+    if (!out) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    printf("%8s %10s %10s %10s  encode\n", "tokens", "load ms", "memory MB", "bytes/tok");
+    scaleRow(vocab, data, length, out);
+    for (size_t i = 0; i < sizeof(scale_sizes) / sizeof(scale_sizes[0]); i++) {
+        if (scale_sizes[i] <= base->num_tokens) continue;
+        char path[] = "/tmp/rwkv_bench_vocab_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to create temporary vocabulary\n");
+            break;
+        }
+        close(fd);
+        if (writeScaledVocab(base, scale_sizes[i], path) == 0) {
+            scaleRow(path, data, length, out);
+        }
+        unlink(path);
+    }
+
+    free(out);
+    free(data);
+    freeTokenizer(base);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--scale") == 0) {
+        return scaleBench(argc > 2 ? argv[2] : "rwkv_vocab_v20230424.txt", argc > 3 ? argv[3] : NULL);
+    }
+    const char* vocab = argc > 1 ? argv[1] : "rwkv_vocab_v20230424.txt";
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+
+    int length;
+    char* data = readInput(argc > 2 ? argv[2] : NULL, &length);
+    if (!data) return 1;
+
+    int* reference = (int*)malloc((length > 0 ? length : 1) * sizeof(int));
+    int* out = (int*)malloc((length > 0 ? length : 1) * sizeof(int));
+    if (!reference || !out) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    tokenizer->matcher = MATCHER_TRIE;
+    int reference_count = encodeInto(tokenizer, data, length, reference);
+    printf("%d tokens, %d bytes input, %d tokens output\n", tokenizer->num_tokens, length, reference_count);
+
+    for (int m = 0; m < NUM_MATCHERS; m++) {
+        if (matcherAvailable(tokenizer, (MatcherKind)m)) {
+            bench((MatcherKind)m, tokenizer, data, length, out, reference, reference_count);
+        }
+    }
+
+    char cache_path[] = "/tmp/rwkv_bench_calibration_XXXXXX";
+    int fd = mkstemp(cache_path);
+    if (fd >= 0) {
+        close(fd);
+        double start = now();
+        MatcherKind chosen = calibrateMatcher(tokenizer, data, length, cache_path);
+        double calibrate_ms = (now() - start) * 1e3;
+        start = now();
+        calibrateMatcher(tokenizer, data, length, cache_path);
+        double cached_ms = (now() - start) * 1e3;
+        printf("calibration picked %s in %.1f ms (%.2f ms from cache)\n", matcherName(chosen), calibrate_ms, cached_ms);
+        unlink(cache_path);
+    }
+
+    free(out);
+    free(reference);
+    free(data);
+    freeTokenizer(tokenizer);
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Compile-time encoding of string literals (C++20) against a vocabulary
+// embedded by rwkv_gen_matcher:
+//
+//   ./rwkv_gen_matcher --constexpr rwkv_vocab_v20230424.txt > rwkv_vocab_constexpr.hpp
+//
+//   constexpr auto separator = rwkv::encode_literal<"\n\nAssistant:">();  // std::array<int, N>
+//
+// The encoder is the same greedy longest match as encodeInto(), over the
+// same trie. At compile time the embedded token table must hash to the
+// vocabulary hash the loader would compute, and every literal must decode
+// back to itself; at runtime, matchesCompiledVocab() confirms the loaded
+// tokenizer is that vocabulary, in which case encodeInto() gives the same ids.
+// rwkv_consteval_check.cpp compares the two encoders on sample literals.
+
+#ifndef RWKV_CONSTEVAL_HPP
+#define RWKV_CONSTEVAL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "rwkv_tokenizer.h"
+
+#ifndef RWKV_CONSTEXPR_VOCAB
+#define RWKV_CONSTEXPR_VOCAB "rwkv_vocab_constexpr.hpp"
+#endif
+#include RWKV_CONSTEXPR_VOCAB
+
+namespace rwkv {
+
+namespace detail {
+
+constexpr int child(int node, unsigned char byte) {
+    for (int e = compiled::node_edges[node]; e < compiled::node_edges[node + 1]; e++) {
+        if (compiled::edge_byte[e] == byte) return compiled::edge_target[e];
+        if (compiled::edge_byte[e] > byte) break;
+    }
+    return -1;
+}
+
+// Stores the id at text[position] and returns the bytes it covers.
+constexpr std::size_t match(std::string_view text, std::size_t position, int& id) {
+    int node = 0;
+    std::size_t end = 0;
+    id = static_cast<unsigned char>(text[position]);
+    for (std::size_t i = position; i < text.size(); i++) {
+        node = child(node, static_cast<unsigned char>(text[i]));
+        if (node < 0) break;
+        if (compiled::node_value[node] != -1) {
+            id = compiled::node_value[node];
+            end = i + 1 - position;
+        }
+    }
+    return end > 0 ? end : 1;
+}
+
+constexpr std::size_t encoded_length(std::string_view text) {
+    std::size_t count = 0;
+    int id = 0;
+    for (std::size_t position = 0; position < text.size(); count++) {
+        position += match(text, position, id);
+    }
+    return count;
+}
+
+// Mirrors addToken()'s FNV-1a over (id, bytes, separator) in id order.
+constexpr std::uint64_t table_hash() {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (int t = 0; t < compiled::num_tokens; t++) {
+        unsigned id = static_cast<unsigned>(compiled::token_id[t]);
+        for (int shift = 0; shift < 32; shift += 8) {
+            hash = (hash ^ ((id >> shift) & 0xFF)) * 1099511628211ULL;
+        }
+        for (int i = compiled::token_offset[t]; i < compiled::token_offset[t + 1]; i++) {
+            hash = (hash ^ compiled::token_bytes[i]) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0xFF) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Byte length of the token `id` when it matches text[position...], or -1.
+constexpr int decoded_match(int id, std::string_view text, std::size_t position) {
+    int lo = 0;
+    int hi = compiled::num_tokens;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (compiled::token_id[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < compiled::num_tokens && compiled::token_id[lo] == id) {
+        int length = compiled::token_offset[lo + 1] - compiled::token_offset[lo];
+        if (position + length > text.size()) return -1;
+        for (int i = 0; i < length; i++) {
+            if (static_cast<unsigned char>(text[position + i]) != compiled::token_bytes[compiled::token_offset[lo] + i]) return -1;
+        }
+        return length;
+    }
+    if (id >= 0 && id < 256 && position < text.size() && static_cast<unsigned char>(text[position]) == id) return 1;
+    return -1;
+}
+
+}  // namespace detail
+
+static_assert(detail::table_hash() == compiled::vocab_hash,
+              "embedded token table does not match its vocabulary hash; regenerate " RWKV_CONSTEXPR_VOCAB);
+
+template <std::size_t N>
+struct literal {
+    char chars[N];
+    consteval literal(const char (&text)[N]) {
+        for (std::size_t i = 0; i < N; i++) chars[i] = text[i];
+    }
+    constexpr std::string_view view() const { return {chars, N - 1}; }
+};
+
+template <literal Text>
+consteval auto encode_literal() {
+    constexpr std::string_view text = Text.view();
+    std::array<int, detail::encoded_length(text)> ids{};
+    std::size_t position = 0;
+    for (int& id : ids) {
+        position += detail::match(text, position, id);
+    }
+    position = 0;
+    for (int id : ids) {
+        int length = detail::decoded_match(id, text, position);
+        if (length < 0) throw "encoded literal does not decode back to itself";
+        position += length;
+    }
+    return ids;
+}
+
+inline bool matchesCompiledVocab(const Tokenizer* tokenizer) {
+    return tokenizer->vocab_hash == compiled::vocab_hash;
+}
+
+}  // namespace rwkv
+
+#endif
@@ -0,0 +1,64 @@
+// Compares rwkv::encode_literal<>() with encodeInto() on the same literals,
+// since the compile-time checks (table hash, decodes back to itself) would
+// also pass for a matcher that is not greedy longest match.
+//
+//   ./rwkv_gen_matcher --constexpr rwkv_vocab_v20230424.txt > rwkv_vocab_constexpr.hpp
+//   gcc -O2 -DRWKV_TOKENIZER_NO_MAIN -c rwkv_tokenizer.c
+//   g++ -std=c++20 -O2 -fconstexpr-ops-limit=1000000000 rwkv_consteval_check.cpp rwkv_tokenizer.o -o rwkv_consteval_check -pthread
+//   ./rwkv_consteval_check [vocab]
+//
+// Exits non-zero if any literal encodes differently.
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+#include "rwkv_consteval.hpp"
+
+template <rwkv::literal Text>
+static bool check(Tokenizer* tokenizer) {
+    constexpr auto expected = rwkv::encode_literal<Text>();
+    std::string_view text = Text.view();
+    std::vector<int> ids(text.size() + 1);
+    int count = encodeInto(tokenizer, text.data(), static_cast<int>(text.size()), ids.data());
+    if (count == static_cast<int>(expected.size()) && std::equal(expected.begin(), expected.end(), ids.begin())) {
+        return true;
+    }
+    std::fprintf(stderr, "Mismatch for \"%.*s\": %zu ids at compile time, %d at runtime\n",
+                 static_cast<int>(text.size()), text.data(), expected.size(), count);
+    return false;
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = argc > 1 ? argv[1] : "rwkv_vocab_v20230424.txt";
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+    if (!rwkv::matchesCompiledVocab(tokenizer)) {
+        std::fprintf(stderr, "%s is not the vocabulary embedded in %s\n", vocab, RWKV_CONSTEXPR_VOCAB);
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+
+    // Chat separators, overlapping prefixes where a shorter token is a
+    // prefix of a longer one, CJK, code and bytes with no token of their own.
+    bool results[] = {
+        check<"\n\nAssistant:">(tokenizer),
+        check<"\n\nUser: ">(tokenizer),
+        check<"User: Hello!\n\nAssistant: Hi there.">(tokenizer),
+        check<"international internationalization internationally">(tokenizer),
+        check<"                                ">(tokenizer),
+        check<"    for (int i = 0; i < n; i++) { total += values[i]; }\n">(tokenizer),
+        check<"我们今天在这里讨论一个问题，这个问题对所有人都很重要。">(tokenizer),
+        check<"日本語のテキストも少し含めます。">(tokenizer),
+        check<"$t$ is a common root of $a,b,c,d,e$ ...!!!???">(tokenizer),
+        check<"\xff\xfe\x80\x01\x7f">(tokenizer),
+        check<"a">(tokenizer),
+    };
+    int mismatches = static_cast<int>(std::count(std::begin(results), std::end(results), false));
+    std::printf("summary literals=%zu mismatches=%d\n", std::size(results), mismatches);
+    freeTokenizer(tokenizer);
+    return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rwkv_contam.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_KICKS 500
+#define NGRAM_BASE 0x9E3779B97F4A7C15ULL
+#define PROBE_DISTANCE 16
+#define HUGE_PAGE_BYTES (2 << 20)
+#define PROBE_RING 64
+
+static inline uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// 0 marks an empty slot, so it is never a fingerprint.
+static inline uint32_t fingerprint(uint64_t hash) {
+    uint32_t fp = (uint32_t)(hash >> 32);
+    return fp ? fp : 1;
+}
+
+// Partial-key cuckoo hashing: the alternate bucket depends only on the
+// current bucket and the fingerprint, so entries can move without the hash.
+static inline uint64_t altBucket(const CuckooFilter* filter, uint64_t bucket, uint32_t fp) {
+    return (bucket ^ ((uint64_t)fp * 0x5BD1E995u)) & filter->mask;
+}
+
+static inline bool bucketHas(const uint32_t* bucket, uint32_t fp) {
+#ifdef __SSE2__
+    __m128i slots = _mm_loadu_si128((const __m128i*)bucket);
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(slots, _mm_set1_epi32((int)fp))) != 0;
+#else
+    return bucket[0] == fp || bucket[1] == fp || bucket[2] == fp || bucket[3] == fp;
+#endif
+}
+
+static inline bool hasOverflowed(const CuckooFilter* filter, uint64_t bucket) {
+    return (filter->overflow[bucket >> 6] >> (bucket & 63)) & 1;
+}
+
+// An entry leaving `bucket` for its other bucket, or placed in its
+// alternate directly, marks `bucket`; lookups that miss in an unmarked
+// primary bucket can skip the alternate.
+static inline void markOverflow(CuckooFilter* filter, uint64_t bucket) {
+    filter->overflow[bucket >> 6] |= 1ULL << (bucket & 63);
+}
+
+static inline bool bucketPut(uint32_t* bucket, uint32_t fp) {
+    for (int i = 0; i < CUCKOO_BUCKET_SLOTS; i++) {
+        if (bucket[i] == 0) {
+            bucket[i] = fp;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Every corpus token probes a random bucket, so large filters are backed by
+// huge pages where available to avoid a TLB miss per lookup.
+static void* allocateSlots(size_t size) {
+    if (size < HUGE_PAGE_BYTES) return calloc(size, 1);
+    size = (size + HUGE_PAGE_BYTES - 1) & ~(size_t)(HUGE_PAGE_BYTES - 1);
+    void* slots = aligned_alloc(HUGE_PAGE_BYTES, size);
+    if (!slots) return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(slots, size, MADV_HUGEPAGE);
+#endif
+    memset(slots, 0, size);
+    return slots;
+}
+
+CuckooFilter* createCuckooFilter(int64_t capacity) {
+    uint64_t num_buckets = 1;
+    while ((double)num_buckets * CUCKOO_BUCKET_SLOTS * 0.9 < (double)capacity) num_buckets *= 2;
+    CuckooFilter* filter = (CuckooFilter*)calloc(1, sizeof(CuckooFilter));
+    if (filter) {
+        filter->slots = (uint32_t*)allocateSlots(num_buckets * CUCKOO_BUCKET_SLOTS * sizeof(uint32_t));
+        filter->overflow = (uint64_t*)calloc((num_buckets + 63) / 64, sizeof(uint64_t));
+    }
+    if (!filter || !filter->slots || !filter->overflow) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    filter->mask = num_buckets - 1;
+    filter->kick_state = 0x2545F491u;
+    return filter;
+}
+
+// On failure the last evicted fingerprint has nowhere to go and is dropped,
+// so the filter must be rebuilt larger.
+bool cuckooInsert(CuckooFilter* filter, uint64_t hash) {
+    uint32_t fp = fingerprint(hash);
+    uint64_t bucket = hash & filter->mask;
+    uint64_t alt = altBucket(filter, bucket, fp);
+    if (bucketPut(filter->slots + bucket * CUCKOO_BUCKET_SLOTS, fp)) {
+        filter->count++;
+        return true;
+    }
+    markOverflow(filter, bucket);
+    if (bucketPut(filter->slots + alt * CUCKOO_BUCKET_SLOTS, fp)) {
+        filter->count++;
+        return true;
+    }
+    uint32_t state = filter->kick_state;
+    if (state & 0x100) bucket = alt;
+    for (int kick = 0; kick < MAX_KICKS; kick++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        uint32_t* victim = filter->slots + bucket * CUCKOO_BUCKET_SLOTS + (state & (CUCKOO_BUCKET_SLOTS - 1));
+        uint32_t evicted = *victim;
+        *victim = fp;
+        fp = evicted;
+        markOverflow(filter, bucket);
+        bucket = altBucket(filter, bucket, fp);
+        if (bucketPut(filter->slots + bucket * CUCKOO_BUCKET_SLOTS, fp)) {
+            filter->kick_state = state;
+            filter->count++;
+            return true;
+        }
+    }
+    filter->kick_state = state;
+    return false;
+}
+
+bool cuckooContains(const CuckooFilter* filter, uint64_t hash) {
+    uint32_t fp = fingerprint(hash);
+    uint64_t bucket = hash & filter->mask;
+    if (bucketHas(filter->slots + bucket * CUCKOO_BUCKET_SLOTS, fp)) return true;
+    return hasOverflowed(filter, bucket) &&
+           bucketHas(filter->slots + altBucket(filter, bucket, fp) * CUCKOO_BUCKET_SLOTS, fp);
+}
+
+void freeCuckooFilter(CuckooFilter* filter) {
+    if (!filter) return;
+    free(filter->slots);
+    free(filter->overflow);
+    free(filter);
+}
+
+// N-grams are hashed with a polynomial rolling hash, so each window costs
+// one multiply-add regardless of n, then mixed before use. Ids are offset by
+// one so that runs of id 0 still change the hash.
+static inline uint64_t rollIn(uint64_t h, int id) {
+    return h * NGRAM_BASE + (uint32_t)id + 1;
+}
+
+static uint64_t leadingPower(int ngram) {
+    uint64_t power = 1;
+    for (int i = 1; i < ngram; i++) power *= NGRAM_BASE;
+    return power;
+}
+
+static int compareHashes(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static char* readFile(const char* path, long* length) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(*length > 0 ? *length : 1);
+    if (!data) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    if (fread(data, 1, *length, file) != (size_t)*length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+EvalIndex* buildEvalIndex(Tokenizer* tokenizer, const char** paths, int num_paths, int ngram) {
+    if (ngram < 1) return NULL;
+    uint64_t power = leadingPower(ngram);
+    uint64_t* hashes = NULL;
+    int64_t num_hashes = 0;
+    int64_t hash_capacity = 0;
+    int64_t num_documents = 0;
+    for (int p = 0; p < num_paths; p++) {
+        long length;
+        char* data = readFile(paths[p], &length);
+        if (!data) {
+            fprintf(stderr, "Failed to read eval file: %s\n", paths[p]);
+            free(hashes);
+            return NULL;
+        }
+        int* ids = (int*)malloc((length > 0 ? length : 1) * sizeof(int));
+        if (!ids) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        long start = 0;
+        while (start < length) {
+            char* newline = (char*)memchr(data + start, '\n', length - start);
+            long end = newline ? newline - data : length;
+            int count = encodeInto(tokenizer, data + start, (int)(end - start), ids);
+            num_documents++;
+            start = end + 1;
+            if (count < ngram) continue;
+            if (num_hashes + count > hash_capacity) {
+                while (num_hashes + count > hash_capacity) hash_capacity = hash_capacity ? hash_capacity * 2 : 1 << 16;
+                hashes = (uint64_t*)realloc(hashes, hash_capacity * sizeof(uint64_t));
+                if (!hashes) {
+                    fprintf(stderr, "Memory allocation failed\n");
+                    exit(1);
+                }
+            }
+            uint64_t h = 0;
+            for (int j = 0; j < ngram; j++) h = rollIn(h, ids[j]);
+            for (int i = 0;; i++) {
+                hashes[num_hashes++] = fmix64(h);
+                if (i + ngram == count) break;
+                h = rollIn(h - ((uint32_t)ids[i] + 1) * power, ids[i + ngram]);
+            }
+        }
+        free(ids);
+        free(data);
+    }
+
+    // Duplicates would pile up in the same two buckets, so dedupe first.
+    if (num_hashes > 0) qsort(hashes, num_hashes, sizeof(uint64_t), compareHashes);
+    int64_t num_distinct = 0;
+    for (int64_t i = 0; i < num_hashes; i++) {
+        if (num_distinct == 0 || hashes[i] != hashes[num_distinct - 1]) hashes[num_distinct++] = hashes[i];
+    }
+    CuckooFilter* filter = NULL;
+    for (int64_t capacity = num_distinct; !filter; capacity *= 2) {
+        filter = createCuckooFilter(capacity > 0 ? capacity : 1);
+        for (int64_t i = 0; i < num_distinct; i++) {
+            if (!cuckooInsert(filter, hashes[i])) {
+                freeCuckooFilter(filter);
+                filter = NULL;
+                break;
+            }
+        }
+    }
+    free(hashes);
+
+    EvalIndex* index = (EvalIndex*)calloc(1, sizeof(EvalIndex));
+    if (!index) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    index->ngram = ngram;
+    index->filter = filter;
+    index->num_documents = num_documents;
+    index->num_ngrams = num_distinct;
+    return index;
+}
+
+bool matchesEvalSet(const EvalIndex* index, const int* ids, int num_ids) {
+    int ngram = index->ngram;
+    if (num_ids < ngram || index->num_ngrams == 0) return false;
+    const CuckooFilter* filter = index->filter;
+    uint64_t power = leadingPower(ngram);
+    int num_windows = num_ids - ngram + 1;
+    uint64_t h = 0;
+    for (int j = 0; j < ngram; j++) h = rollIn(h, ids[j]);
+    // Window w is hashed and its buckets prefetched PROBE_DISTANCE windows
+    // before it is probed.
+    uint64_t hashes[PROBE_RING];
+    for (int w = 0; w < num_windows + PROBE_DISTANCE; w++) {
+        if (w < num_windows) {
+            uint64_t hash = fmix64(h);
+            hashes[w & (PROBE_RING - 1)] = hash;
+            uint64_t bucket = hash & filter->mask;
+            __builtin_prefetch(filter->slots + bucket * CUCKOO_BUCKET_SLOTS);
+            if (hasOverflowed(filter, bucket)) {
+                __builtin_prefetch(filter->slots + altBucket(filter, bucket, fingerprint(hash)) * CUCKOO_BUCKET_SLOTS);
+            }
+            if (w + ngram < num_ids) h = rollIn(h - ((uint32_t)ids[w] + 1) * power, ids[w + ngram]);
+        }
+        if (w >= PROBE_DISTANCE && cuckooContains(filter, hashes[(w - PROBE_DISTANCE) & (PROBE_RING - 1)])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void freeEvalIndex(EvalIndex* index) {
+    if (!index) return;
+    freeCuckooFilter(index->filter);
+    free(index);
+}
@@ -0,0 +1,52 @@
+#ifndef RWKV_CONTAM_H
+#define RWKV_CONTAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rwkv_tokenizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CUCKOO_BUCKET_SLOTS 4
+
+// Cuckoo filter over 64-bit hashes with 32-bit fingerprints in buckets of
+// four, so a bucket is one 16-byte compare. The false positive rate is
+// about 8 / 2^32 per lookup, low enough to test every n-gram of a corpus.
+typedef struct {
+    uint32_t* slots;  // num_buckets * CUCKOO_BUCKET_SLOTS, 0 = empty
+    uint64_t mask;    // num_buckets - 1
+    uint64_t* overflow;  // bit per bucket: some entry hashed here lives in its alternate
+    int64_t count;
+    uint32_t kick_state;
+} CuckooFilter;
+
+// Sized for `capacity` entries at no more than 90% load.
+CuckooFilter* createCuckooFilter(int64_t capacity);
+// Returns false if the filter is too full to place the entry.
+bool cuckooInsert(CuckooFilter* filter, uint64_t hash);
+bool cuckooContains(const CuckooFilter* filter, uint64_t hash);
+void freeCuckooFilter(CuckooFilter* filter);
+
+// Token n-grams of evaluation sets, for flagging training documents that
+// share any of them.
+typedef struct {
+    int ngram;
+    CuckooFilter* filter;
+    int64_t num_documents;
+    int64_t num_ngrams;  // distinct, up to filter false positives
+} EvalIndex;
+
+// Encodes each file (one document per line) and indexes every n-gram that
+// lies within a document. Returns NULL if a file cannot be read.
+EvalIndex* buildEvalIndex(Tokenizer* tokenizer, const char** paths, int num_paths, int ngram);
+// True if any n-gram window of `ids` is in the index; stops at the first.
+bool matchesEvalSet(const EvalIndex* index, const int* ids, int num_ids);
+void freeEvalIndex(EvalIndex* index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,631 @@
+// Batch-encodes a text file, one document per line, into
+// <output>.bin (uint16 ids, little-endian) and <output>.idx (uint64
+// cumulative token offsets: document i is ids [idx[i], idx[i + 1])).
+//
+//   ./rwkv_encode [-v vocab] [-t threads] [--progress] [--trace trace.json]
+//                 [--minhash [--minhash-ngram N] [--minhash-bands B]]
+//                 [--eval eval.txt ... [--eval-ngram N]] input.txt output
+//
+// The input is read in chunks of whole lines; chunks are encoded on the
+// thread pool and written back in input order.
+//
+// --minhash also writes <output>.minhash: MinHash signatures over token
+// n-grams, computed from each document's ids while they are still in cache
+// (see rwkv_minhash.h). The file starts with the 8 bytes "RWKVMH1\0" and
+// uint32 bins, ngram, bands, rows and seed, followed by one record per
+// document: `bins` uint32 values, then `bands` uint64 LSH band hashes. All
+// little-endian.
+//
+// --eval (repeatable) loads evaluation sets, one document per line, and
+// writes <output>.contam: the 8 bytes "RWKVCT1\0" and uint32 ngram, then
+// one byte per document, 1 if any of its token n-grams (default 13) occurs
+// in an eval document. Eval n-grams are kept in a cuckoo filter (see
+// rwkv_contam.h) and each document is checked as it is encoded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rwkv_tokenizer.h"
+#include "rwkv_trace.h"
+#include "rwkv_minhash.h"
+#include "rwkv_contam.h"
+
+#define CHUNK_BYTES (4 << 20)
+#define MAX_PROGRESS_SLOTS 64
+#define PROGRESS_INTERVAL_SECONDS 1
+#define MINHASH_SEED 0x524B4D48u
+
+// One cache line per encoder thread so workers never share a line; the
+// reporter sums all slots.
+typedef struct {
+    _Alignas(64) atomic_llong bytes;
+    atomic_llong tokens;
+    atomic_llong docs;
+} ProgressCounters;
+
+typedef struct {
+    ProgressCounters slots[MAX_PROGRESS_SLOTS];
+    atomic_int next_slot;
+    int64_t total_bytes;
+    double start;
+    bool tty;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Progress;
+
+typedef struct {
+    int64_t bytes;
+    int64_t tokens;
+    int64_t docs;
+} ProgressTotals;
+
+typedef struct {
+    int64_t seq;
+    char* data;
+    int length;
+    int* doc_starts;
+    int* doc_lengths;
+    int num_docs;
+    uint16_t* ids;
+    int64_t* doc_ends;  // cumulative token counts within the chunk
+    int64_t num_ids;
+    bool overflow;
+    uint32_t* signatures;  // MINHASH_BINS per document, with --minhash
+    uint64_t* band_hashes;
+    uint8_t* contaminated;  // per document, with --eval
+} Chunk;
+
+typedef struct {
+    Tokenizer* tokenizer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Chunk** ready;  // completed chunks, slot seq % window
+    int window;
+    int in_flight;
+    int64_t chunks_read;
+    int64_t next_write;
+    bool done_reading;
+    bool failed;
+    FILE* bin;
+    FILE* idx;
+    MinHasher* minhasher;  // NULL without --minhash
+    FILE* minhash;
+    EvalIndex* eval;  // NULL without --eval
+    FILE* contam;
+    int64_t contaminated_docs;
+    int64_t tokens_written;
+    int64_t docs_written;
+    Progress progress;
+} Pipeline;
+
+typedef struct {
+    Pipeline* pipeline;
+    Chunk* chunk;
+} EncodeTask;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static _Thread_local int progress_slot = -1;
+
+static ProgressCounters* progressCounters(Progress* progress) {
+    if (progress_slot < 0) {
+        progress_slot = atomic_fetch_add_explicit(&progress->next_slot, 1, memory_order_relaxed);
+        // Extra threads share the last slot; the counters are atomic either way.
+        if (progress_slot >= MAX_PROGRESS_SLOTS) progress_slot = MAX_PROGRESS_SLOTS - 1;
+    }
+    return &progress->slots[progress_slot];
+}
+
+static ProgressTotals progressTotals(Progress* progress) {
+    ProgressTotals totals = {0, 0, 0};
+    for (int i = 0; i < MAX_PROGRESS_SLOTS; i++) {
+        totals.bytes += atomic_load_explicit(&progress->slots[i].bytes, memory_order_relaxed);
+        totals.tokens += atomic_load_explicit(&progress->slots[i].tokens, memory_order_relaxed);
+        totals.docs += atomic_load_explicit(&progress->slots[i].docs, memory_order_relaxed);
+    }
+    return totals;
+}
+
+// Rates cover the last interval; the ETA uses the average since start.
+static void printProgress(Progress* progress, ProgressTotals* last, double* last_time) {
+    ProgressTotals totals = progressTotals(progress);
+    double t = now();
+    double interval = t - *last_time;
+    double elapsed = t - progress->start;
+    double bytes_per_second = interval > 0 ? (totals.bytes - last->bytes) / interval : 0;
+    double tokens_per_second = interval > 0 ? (totals.tokens - last->tokens) / interval : 0;
+    char eta[32] = "?";
+    if (elapsed > 0 && totals.bytes > 0 && progress->total_bytes > 0) {
+        int64_t remaining = (int64_t)((progress->total_bytes - totals.bytes) / (totals.bytes / elapsed));
+        if (remaining < 0) remaining = 0;
+        snprintf(eta, sizeof(eta), "%lld:%02lld:%02lld", (long long)(remaining / 3600),
+                 (long long)(remaining / 60 % 60), (long long)(remaining % 60));
+    }
+    fprintf(stderr, "%s%.1f MB/s  %.2f Mtok/s  %lld docs  %.2f bytes/token  %.1f%%  ETA %s%s",
+            progress->tty ? "\r" : "",
+            bytes_per_second / 1e6, tokens_per_second / 1e6, (long long)totals.docs,
+            totals.tokens > 0 ? (double)totals.bytes / totals.tokens : 0,
+            progress->total_bytes > 0 ? 100.0 * totals.bytes / progress->total_bytes : 0, eta,
+            progress->tty ? "  " : "\n");
+    *last = totals;
+    *last_time = t;
+}
+
+static void* progressThread(void* arg) {
+    Progress* progress = (Progress*)arg;
+    ProgressTotals last = {0, 0, 0};
+    double last_time = progress->start;
+    pthread_mutex_lock(&progress->lock);
+    while (!progress->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += PROGRESS_INTERVAL_SECONDS;
+        pthread_cond_timedwait(&progress->cond, &progress->lock, &deadline);
+        if (!progress->stop) printProgress(progress, &last, &last_time);
+    }
+    pthread_mutex_unlock(&progress->lock);
+    if (progress->tty) fprintf(stderr, "\n");
+    return NULL;
+}
+
+static void* xmalloc(size_t size) {
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (!ptr) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void freeChunk(Chunk* chunk) {
+    free(chunk->data);
+    free(chunk->doc_starts);
+    free(chunk->doc_lengths);
+    free(chunk->ids);
+    free(chunk->doc_ends);
+    free(chunk->signatures);
+    free(chunk->band_hashes);
+    free(chunk->contaminated);
+    free(chunk);
+}
+
+static void splitDocuments(Chunk* chunk) {
+    int capacity = 1024;
+    chunk->doc_starts = (int*)xmalloc(capacity * sizeof(int));
+    chunk->doc_lengths = (int*)xmalloc(capacity * sizeof(int));
+    chunk->num_docs = 0;
+    int start = 0;
+    while (start < chunk->length) {
+        char* newline = (char*)memchr(chunk->data + start, '\n', chunk->length - start);
+        int end = newline ? (int)(newline - chunk->data) : chunk->length;
+        if (chunk->num_docs == capacity) {
+            capacity *= 2;
+            chunk->doc_starts = (int*)realloc(chunk->doc_starts, capacity * sizeof(int));
+            chunk->doc_lengths = (int*)realloc(chunk->doc_lengths, capacity * sizeof(int));
+            if (!chunk->doc_starts || !chunk->doc_lengths) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        chunk->doc_starts[chunk->num_docs] = start;
+        chunk->doc_lengths[chunk->num_docs] = end - start;
+        chunk->num_docs++;
+        start = end + 1;
+    }
+}
+
+static void encodeChunk(void* arg) {
+    EncodeTask* task = (EncodeTask*)arg;
+    Pipeline* pipeline = task->pipeline;
+    Chunk* chunk = task->chunk;
+    free(task);
+
+    TRACE_THREAD_NAME("encoder");
+    TRACE_BEGIN(TRACE_ENCODE);
+    int* scratch = (int*)xmalloc(chunk->length * sizeof(int));
+    chunk->ids = (uint16_t*)xmalloc(chunk->length * sizeof(uint16_t));
+    chunk->doc_ends = (int64_t*)xmalloc(chunk->num_docs * sizeof(int64_t));
+    MinHasher* minhasher = pipeline->minhasher;
+    if (minhasher) {
+        chunk->signatures = (uint32_t*)xmalloc((size_t)chunk->num_docs * MINHASH_BINS * sizeof(uint32_t));
+        chunk->band_hashes = (uint64_t*)xmalloc((size_t)chunk->num_docs * minhasher->bands * sizeof(uint64_t));
+    }
+    EvalIndex* eval = pipeline->eval;
+    if (eval) chunk->contaminated = (uint8_t*)xmalloc(chunk->num_docs);
+    ProgressCounters* counters = progressCounters(&pipeline->progress);
+    int64_t total = 0;
+    int64_t bytes_counted = 0;
+    for (int d = 0; d < chunk->num_docs; d++) {
+        int count = encodeInto(pipeline->tokenizer, chunk->data + chunk->doc_starts[d], chunk->doc_lengths[d], scratch);
+        for (int i = 0; i < count; i++) {
+            if (scratch[i] > UINT16_MAX) chunk->overflow = true;
+            chunk->ids[total + i] = (uint16_t)scratch[i];
+        }
+        if (minhasher) {
+            uint32_t* signature = chunk->signatures + (size_t)d * MINHASH_BINS;
+            minhashIds(minhasher, scratch, count, signature);
+            minhashBands(minhasher, signature, chunk->band_hashes + (size_t)d * minhasher->bands);
+        }
+        if (eval) chunk->contaminated[d] = matchesEvalSet(eval, scratch, count);
+        total += count;
+        chunk->doc_ends[d] = total;
+        atomic_fetch_add_explicit(&counters->bytes, chunk->doc_lengths[d], memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->tokens, count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->docs, 1, memory_order_relaxed);
+        bytes_counted += chunk->doc_lengths[d];
+    }
+    // Newlines between documents.
+    atomic_fetch_add_explicit(&counters->bytes, chunk->length - bytes_counted, memory_order_relaxed);
+    chunk->num_ids = total;
+    free(scratch);
+    TRACE_END(TRACE_ENCODE);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->ready[chunk->seq % pipeline->window] = chunk;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void* writerThread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    TRACE_THREAD_NAME("writer");
+    uint64_t offset = 0;
+    if (fwrite(&offset, sizeof(offset), 1, pipeline->idx) != 1) pipeline->failed = true;
+    for (;;) {
+        TRACE_BEGIN(TRACE_REORDER);
+        pthread_mutex_lock(&pipeline->lock);
+        int slot = pipeline->next_write % pipeline->window;
+        while (!pipeline->ready[slot] &&
+               !(pipeline->done_reading && pipeline->next_write == pipeline->chunks_read)) {
+            pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+        }
+        Chunk* chunk = pipeline->ready[slot];
+        pipeline->ready[slot] = NULL;
+        pthread_mutex_unlock(&pipeline->lock);
+        TRACE_END(TRACE_REORDER);
+        if (!chunk) break;
+
+        TRACE_BEGIN(TRACE_WRITE);
+        if (chunk->overflow) {
+            fprintf(stderr, "Token ID does not fit in 16 bits\n");
+            pipeline->failed = true;
+        }
+        if (fwrite(chunk->ids, sizeof(uint16_t), chunk->num_ids, pipeline->bin) != (size_t)chunk->num_ids) {
+            pipeline->failed = true;
+        }
+        for (int d = 0; d < chunk->num_docs; d++) {
+            offset = pipeline->tokens_written + chunk->doc_ends[d];
+            if (fwrite(&offset, sizeof(offset), 1, pipeline->idx) != 1) pipeline->failed = true;
+        }
+        if (pipeline->minhasher) {
+            int bands = pipeline->minhasher->bands;
+            for (int d = 0; d < chunk->num_docs; d++) {
+                if (fwrite(chunk->signatures + (size_t)d * MINHASH_BINS, sizeof(uint32_t),
+                           MINHASH_BINS, pipeline->minhash) != MINHASH_BINS ||
+                    fwrite(chunk->band_hashes + (size_t)d * bands, sizeof(uint64_t), bands, pipeline->minhash) !=
+                        (size_t)bands) {
+                    pipeline->failed = true;
+                }
+            }
+        }
+        if (pipeline->eval) {
+            if (fwrite(chunk->contaminated, 1, chunk->num_docs, pipeline->contam) != (size_t)chunk->num_docs) {
+                pipeline->failed = true;
+            }
+            for (int d = 0; d < chunk->num_docs; d++) pipeline->contaminated_docs += chunk->contaminated[d];
+        }
+        pipeline->tokens_written += chunk->num_ids;
+        pipeline->docs_written += chunk->num_docs;
+        TRACE_END(TRACE_WRITE);
+        freeChunk(chunk);
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->next_write++;
+        pipeline->in_flight--;
+        pthread_cond_broadcast(&pipeline->cond);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    return NULL;
+}
+
+// Reads up to CHUNK_BYTES, extended to the end of the last complete line.
+// `carry` holds bytes read past that line for the next call.
+static Chunk* readChunk(FILE* input, char** carry, int* carry_length, int* carry_capacity, bool* eof) {
+    int capacity = CHUNK_BYTES;
+    while (capacity < *carry_length * 2) capacity *= 2;
+    char* data = (char*)xmalloc(capacity);
+    int length = *carry_length;
+    memcpy(data, *carry, length);
+    *carry_length = 0;
+
+    int cut = -1;
+    while (cut < 0 && !*eof) {
+        if (length == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
+            if (!data) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        size_t n = fread(data + length, 1, capacity - length, input);
+        if (n == 0) {
+            *eof = true;
+            break;
+        }
+        int scan_from = length;
+        length += (int)n;
+        for (int i = length - 1; i >= scan_from; i--) {
+            if (data[i] == '\n') {
+                cut = i + 1;
+                break;
+            }
+        }
+    }
+    if (cut < 0) cut = length;
+    if (cut == 0) {
+        free(data);
+        return NULL;
+    }
+
+    *carry_length = length - cut;
+    if (*carry_length > *carry_capacity) {
+        *carry_capacity = *carry_length;
+        *carry = (char*)realloc(*carry, *carry_capacity);
+        if (!*carry) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    memcpy(*carry, data + cut, *carry_length);
+    Chunk* chunk = (Chunk*)calloc(1, sizeof(Chunk));
+    if (!chunk) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    chunk->data = data;
+    chunk->length = cut;
+    splitDocuments(chunk);
+    return chunk;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-v vocab] [-t threads] [--progress] [--trace trace.json] "
+            "[--minhash [--minhash-ngram N] [--minhash-bands B]] [--eval eval.txt ... [--eval-ngram N]] "
+            "input.txt output\n", argv0);
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = "rwkv_vocab_v20230424.txt";
+    const char* trace_path = NULL;
+    bool show_progress = false;
+    bool minhash = false;
+    int minhash_ngram = 5;
+    int minhash_bands = 16;
+    const char** eval_paths = (const char**)xmalloc(argc * sizeof(char*));
+    int num_eval_paths = 0;
+    int eval_ngram = 13;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (int)cpus : 1;
+    const char* positional[2];
+    int num_positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            vocab = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--progress") == 0) {
+            show_progress = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--minhash") == 0) {
+            minhash = true;
+        } else if (strcmp(argv[i], "--minhash-ngram") == 0 && i + 1 < argc) {
+            minhash_ngram = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--minhash-bands") == 0 && i + 1 < argc) {
+            minhash_bands = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eval") == 0 && i + 1 < argc) {
+            eval_paths[num_eval_paths++] = argv[++i];
+        } else if (strcmp(argv[i], "--eval-ngram") == 0 && i + 1 < argc) {
+            eval_ngram = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && num_positional < 2) {
+            positional[num_positional++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (num_positional != 2 || threads < 1 || eval_ngram < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    MinHasher* minhasher = NULL;
+    if (minhash) {
+        minhasher = createMinHasher(minhash_ngram, minhash_bands, MINHASH_SEED);
+        if (!minhasher) {
+            fprintf(stderr, "--minhash-ngram must be positive and --minhash-bands must divide %d\n",
+                    MINHASH_BINS);
+            return 1;
+        }
+    }
+    if (trace_path) traceEnable();
+    TRACE_THREAD_NAME("reader");
+
+    Tokenizer* tokenizer = createTokenizer();
+    TRACE_BEGIN(TRACE_LOAD_VOCAB);
+    int loaded = loadVocab(tokenizer, vocab);
+    TRACE_END(TRACE_LOAD_VOCAB);
+    if (loaded != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+    EvalIndex* eval = NULL;
+    if (num_eval_paths > 0) {
+        double eval_start = now();
+        eval = buildEvalIndex(tokenizer, eval_paths, num_eval_paths, eval_ngram);
+        if (!eval) {
+            freeTokenizer(tokenizer);
+            return 1;
+        }
+        fprintf(stderr, "eval docs=%lld ngrams=%lld filter_mb=%.1f seconds=%.3f\n", (long long)eval->num_documents,
+                (long long)eval->num_ngrams,
+                (eval->filter->mask + 1) * CUCKOO_BUCKET_SLOTS * sizeof(uint32_t) / 1e6, now() - eval_start);
+    }
+
+    FILE* input = fopen(positional[0], "rb");
+    if (!input) {
+        fprintf(stderr, "Failed to open input file: %s\n", positional[0]);
+        return 1;
+    }
+    size_t prefix_length = strlen(positional[1]);
+    char* bin_path = (char*)xmalloc(prefix_length + 5);
+    char* idx_path = (char*)xmalloc(prefix_length + 5);
+    char* minhash_path = (char*)xmalloc(prefix_length + 9);
+    char* contam_path = (char*)xmalloc(prefix_length + 8);
+    snprintf(bin_path, prefix_length + 5, "%s.bin", positional[1]);
+    snprintf(idx_path, prefix_length + 5, "%s.idx", positional[1]);
+    snprintf(minhash_path, prefix_length + 9, "%s.minhash", positional[1]);
+    snprintf(contam_path, prefix_length + 8, "%s.contam", positional[1]);
+
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.tokenizer = tokenizer;
+    pipeline.window = threads * 2;
+    pipeline.ready = (Chunk**)calloc(pipeline.window, sizeof(Chunk*));
+    pipeline.bin = fopen(bin_path, "wb");
+    pipeline.idx = fopen(idx_path, "wb");
+    if (!pipeline.ready || !pipeline.bin || !pipeline.idx) {
+        fprintf(stderr, "Failed to open output files: %s, %s\n", bin_path, idx_path);
+        return 1;
+    }
+    if (minhasher) {
+        pipeline.minhasher = minhasher;
+        pipeline.minhash = fopen(minhash_path, "wb");
+        if (!pipeline.minhash) {
+            fprintf(stderr, "Failed to open output file: %s\n", minhash_path);
+            return 1;
+        }
+        uint32_t header[5] = {MINHASH_BINS, (uint32_t)minhasher->ngram, (uint32_t)minhasher->bands,
+                              (uint32_t)(MINHASH_BINS / minhasher->bands), MINHASH_SEED};
+        if (fwrite("RWKVMH1", 1, 8, pipeline.minhash) != 8 || fwrite(header, sizeof(header), 1, pipeline.minhash) != 1) {
+            pipeline.failed = true;
+        }
+    }
+    if (eval) {
+        pipeline.eval = eval;
+        pipeline.contam = fopen(contam_path, "wb");
+        if (!pipeline.contam) {
+            fprintf(stderr, "Failed to open output file: %s\n", contam_path);
+            return 1;
+        }
+        uint32_t ngram = (uint32_t)eval->ngram;
+        if (fwrite("RWKVCT1", 1, 8, pipeline.contam) != 8 || fwrite(&ngram, sizeof(ngram), 1, pipeline.contam) != 1) {
+            pipeline.failed = true;
+        }
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+
+    Progress* progress = &pipeline.progress;
+    struct stat input_stat;
+    progress->total_bytes = fstat(fileno(input), &input_stat) == 0 && S_ISREG(input_stat.st_mode) ? input_stat.st_size : 0;
+    progress->tty = isatty(STDERR_FILENO);
+    pthread_mutex_init(&progress->lock, NULL);
+    pthread_cond_init(&progress->cond, NULL);
+
+    double start = now();
+    progress->start = start;
+    pthread_t reporter;
+    if (show_progress && pthread_create(&reporter, NULL, progressThread, progress) != 0) {
+        fprintf(stderr, "Failed to start progress thread\n");
+        show_progress = false;
+    }
+    ThreadPool* pool = createThreadPool(threads);
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, writerThread, &pipeline) != 0) {
+        fprintf(stderr, "Failed to start writer thread\n");
+        return 1;
+    }
+
+    char* carry = (char*)xmalloc(CHUNK_BYTES);
+    int carry_length = 0;
+    int carry_capacity = CHUNK_BYTES;
+    int64_t bytes_read = 0;
+    bool eof = false;
+    for (;;) {
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.in_flight >= pipeline.window) {
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        TRACE_BEGIN(TRACE_READ);
+        Chunk* chunk = readChunk(input, &carry, &carry_length, &carry_capacity, &eof);
+        TRACE_END(TRACE_READ);
+        if (!chunk) break;
+        bytes_read += chunk->length;
+
+        EncodeTask* task = (EncodeTask*)xmalloc(sizeof(EncodeTask));
+        task->pipeline = &pipeline;
+        task->chunk = chunk;
+        pthread_mutex_lock(&pipeline.lock);
+        chunk->seq = pipeline.chunks_read++;
+        pipeline.in_flight++;
+        pthread_mutex_unlock(&pipeline.lock);
+        threadPoolSubmit(pool, encodeChunk, task);
+    }
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.done_reading = true;
+    pthread_cond_broadcast(&pipeline.cond);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    pthread_join(writer, NULL);
+    freeThreadPool(pool);
+    double elapsed = now() - start;
+    if (show_progress) {
+        pthread_mutex_lock(&progress->lock);
+        progress->stop = true;
+        pthread_cond_signal(&progress->cond);
+        pthread_mutex_unlock(&progress->lock);
+        pthread_join(reporter, NULL);
+    }
+
+    if (fclose(pipeline.bin) != 0 || fclose(pipeline.idx) != 0) pipeline.failed = true;
+    if (pipeline.minhash && fclose(pipeline.minhash) != 0) pipeline.failed = true;
+    if (pipeline.contam && fclose(pipeline.contam) != 0) pipeline.failed = true;
+    fclose(input);
+    fprintf(stderr, "summary docs=%lld bytes=%lld tokens=%lld seconds=%.3f mb_per_s=%.1f mtok_per_s=%.2f bytes_per_token=%.3f threads=%d",
+            (long long)pipeline.docs_written, (long long)bytes_read, (long long)pipeline.tokens_written, elapsed,
+            elapsed > 0 ? bytes_read / elapsed / 1e6 : 0, elapsed > 0 ? pipeline.tokens_written / elapsed / 1e6 : 0,
+            pipeline.tokens_written > 0 ? (double)bytes_read / pipeline.tokens_written : 0, threads);
+    if (eval) fprintf(stderr, " contaminated_docs=%lld", (long long)pipeline.contaminated_docs);
+    fprintf(stderr, "\n");
+
+    if (trace_path) traceDump(trace_path);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&progress->lock);
+    pthread_cond_destroy(&progress->cond);
+    free(pipeline.ready);
+    free(carry);
+    free(bin_path);
+    free(idx_path);
+    free(minhash_path);
+    free(contam_path);
+    free(eval_paths);
+    freeMinHasher(minhasher);
+    freeEvalIndex(eval);
+    freeTokenizer(tokenizer);
+    return pipeline.failed ? 1 : 0;
+}
@@ -0,0 +1,351 @@
+// Emits C source for a matcher specialised to one vocabulary: every trie
+// node becomes a labelled switch on the next byte, so the compiler lays out
+// branches and jump tables instead of the encoder chasing child pointers.
+//
+//   ./rwkv_gen_matcher rwkv_vocab_v20230424.txt [sample.txt] > rwkv_matcher_gen.c
+//   ./rwkv_gen_matcher --constexpr rwkv_vocab_v20230424.txt > rwkv_vocab_constexpr.hpp
+//
+// With a sample text, nodes are ordered by how often encoding the sample
+// visits them; otherwise by the number of tokens below them. Hotter children
+// are emitted first so the common path falls through.
+//
+// --constexpr instead emits the trie and token table as C++ constant arrays
+// for the compile-time encoder in rwkv_consteval.hpp.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "rwkv_tokenizer.h"
+
+typedef struct {
+    const TrieNode* node;
+    int index;
+} NodeSlot;
+
+typedef struct {
+    NodeSlot* slots;
+    size_t capacity;
+    int count;
+} NodeMap;
+
+typedef struct {
+    const TrieNode* node;
+    unsigned char byte;
+} Edge;
+
+static NodeMap nodes;
+static uint64_t* heat;
+
+static size_t hashPointer(const void* ptr) {
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static int nodeIndex(const TrieNode* node) {
+    size_t i = hashPointer(node) & (nodes.capacity - 1);
+    while (nodes.slots[i].node && nodes.slots[i].node != node) {
+        i = (i + 1) & (nodes.capacity - 1);
+    }
+    if (!nodes.slots[i].node) {
+        nodes.slots[i].node = node;
+        nodes.slots[i].index = nodes.count++;
+    }
+    return nodes.slots[i].index;
+}
+
+static int countNodes(const TrieNode* node) {
+    int count = 1;
+    for (int c = 0; c < 256; c++) {
+        const TrieNode* child = trieChild(node, (unsigned char)c);
+        if (child) count += countNodes(child);
+    }
+    return count;
+}
+
+static uint64_t subtreeTokens(const TrieNode* node) {
+    uint64_t count = node->value != -1;
+    for (int c = 0; c < 256; c++) {
+        const TrieNode* child = trieChild(node, (unsigned char)c);
+        if (child) count += subtreeTokens(child);
+    }
+    heat[nodeIndex(node)] = count;
+    return count;
+}
+
+static void profileSample(const Tokenizer* tokenizer, const unsigned char* data, long length) {
+    memset(heat, 0, nodes.capacity * sizeof(uint64_t));
+    long index = 0;
+    while (index < length) {
+        const TrieNode* node = tokenizer->root;
+        long i = index;
+        int end = 0;
+        const TrieNode* child;
+        while (i < length && (child = trieChild(node, data[i]))) {
+            node = child;
+            heat[nodeIndex(node)]++;
+            i++;
+            if (node->value != -1) end = (int)(i - index);
+        }
+        index += end > 0 ? end : 1;
+    }
+}
+
+static int compareEdges(const void* a, const void* b) {
+    uint64_t ha = heat[nodeIndex(((const Edge*)a)->node)];
+    uint64_t hb = heat[nodeIndex(((const Edge*)b)->node)];
+    if (ha != hb) return ha < hb ? 1 : -1;
+    return (int)((const Edge*)a)->byte - (int)((const Edge*)b)->byte;
+}
+
+static int hotChildren(const TrieNode* node, Edge* edges) {
+    int count = 0;
+    for (int c = 0; c < 256; c++) {
+        const TrieNode* child = trieChild(node, (unsigned char)c);
+        if (child) {
+            edges[count].node = child;
+            edges[count].byte = (unsigned char)c;
+            count++;
+        }
+    }
+    qsort(edges, count, sizeof(Edge), compareEdges);
+    return count;
+}
+
+static bool hasChildren(const TrieNode* node) {
+    return node->num_children > 0;
+}
+
+// The first node of each function is entered by falling through, so only
+// nodes reached by a goto get a label.
+static void emitNode(FILE* out, const TrieNode* node, bool labelled) {
+    Edge edges[256];
+    int count = hotChildren(node, edges);
+    if (labelled) fprintf(out, "n%d:\n", nodeIndex(node));
+    fprintf(out, "    if (i >= data_length) goto done;\n");
+    fprintf(out, "    switch (data[i]) {\n");
+    for (int e = 0; e < count; e++) {
+        const TrieNode* child = edges[e].node;
+        fprintf(out, "    case 0x%02x: i++;", edges[e].byte);
+        if (child->value != -1) {
+            fprintf(out, " value = %d; end = i;", child->value);
+        }
+        if (hasChildren(child)) {
+            fprintf(out, " goto n%d;\n", nodeIndex(child));
+        } else {
+            fprintf(out, " goto done;\n");
+        }
+    }
+    fprintf(out, "    default: goto done;\n");
+    fprintf(out, "    }\n");
+    for (int e = 0; e < count; e++) {
+        if (hasChildren(edges[e].node)) emitNode(out, edges[e].node, true);
+    }
+}
+
+static void emitMatcher(FILE* out, const Tokenizer* tokenizer) {
+    Edge edges[256];
+    int count = hotChildren(tokenizer->root, edges);
+
+    fprintf(out, "// Generated by rwkv_gen_matcher. Do not edit.\n");
+    fprintf(out, "#include \"rwkv_tokenizer.h\"\n\n");
+    fprintf(out, "const uint64_t rwkv_generated_vocab_hash = 0x%016" PRIx64 "ULL;\n\n", tokenizer->vocab_hash);
+
+    for (int e = 0; e < count; e++) {
+        const TrieNode* first = edges[e].node;
+        fprintf(out, "static int m%02x(const unsigned char* data, int data_length, int* endIndex) {\n", edges[e].byte);
+        fprintf(out, "    int value = %d;\n", first->value);
+        fprintf(out, "    int end = %d;\n", first->value != -1 ? 1 : 0);
+        fprintf(out, "    int i = 1;\n");
+        if (hasChildren(first)) {
+            emitNode(out, first, false);
+        } else {
+            fprintf(out, "    (void)data;\n    (void)data_length;\n    (void)i;\n");
+            fprintf(out, "    goto done;\n");
+        }
+        fprintf(out, "done:\n");
+        fprintf(out, "    *endIndex = end;\n");
+        fprintf(out, "    return value;\n");
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "int findLongestGenerated(const unsigned char* data, int data_length, int* endIndex) {\n");
+    fprintf(out, "    if (data_length > 0) {\n");
+    fprintf(out, "        switch (data[0]) {\n");
+    for (int e = 0; e < count; e++) {
+        fprintf(out, "        case 0x%02x: return m%02x(data, data_length, endIndex);\n", edges[e].byte, edges[e].byte);
+    }
+    fprintf(out, "        default: break;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    *endIndex = 0;\n");
+    fprintf(out, "    return -1;\n");
+    fprintf(out, "}\n");
+}
+
+static void emitArrayValue(FILE* out, int index, long long value) {
+    fprintf(out, "%s%lld,", index % 16 == 0 ? "\n    " : " ", value);
+}
+
+// Nodes are numbered breadth first, so each node's edges are contiguous and
+// sorted by byte. The token table is hashed in id order at compile time and
+// has to reproduce the loader's hash, which holds for id-sorted vocab files.
+static int emitConstexpr(FILE* out, const Tokenizer* tokenizer, int num_nodes) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int id = 0; id <= tokenizer->max_token_id; id++) {
+        if (tokenizer->token_length[id] == -1) continue;
+        const unsigned char* token = tokenizer->token_data + tokenizer->token_offset[id];
+        for (int shift = 0; shift < 32; shift += 8) {
+            hash = (hash ^ ((unsigned)id >> shift & 0xFF)) * 1099511628211ULL;
+        }
+        for (int i = 0; i < tokenizer->token_length[id]; i++) {
+            hash = (hash ^ token[i]) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0xFF) * 1099511628211ULL;
+    }
+    if (hash != tokenizer->vocab_hash) {
+        fprintf(stderr, "Vocabulary is not sorted by id; its hash depends on file order\n");
+        return -1;
+    }
+
+    const TrieNode** queue = (const TrieNode**)malloc(num_nodes * sizeof(TrieNode*));
+    if (!queue) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    int queued = 0;
+    queue[queued++] = tokenizer->root;
+
+    fprintf(out, "// Generated by rwkv_gen_matcher --constexpr. Do not edit.\n");
+    fprintf(out, "#pragma once\n\n#include <cstdint>\n\n");
+    fprintf(out, "namespace rwkv::compiled {\n\n");
+    fprintf(out, "inline constexpr std::uint64_t vocab_hash = 0x%016" PRIx64 "ULL;\n", tokenizer->vocab_hash);
+    fprintf(out, "inline constexpr int num_nodes = %d;\n\n", num_nodes);
+
+    // value, first edge, edge count per node; edges as parallel arrays.
+    fprintf(out, "inline constexpr int node_value[] = {");
+    for (int n = 0; n < num_nodes; n++) {
+        const TrieNode* node = queue[n];
+        emitArrayValue(out, n, node->value);
+        for (int c = 0; c < 256; c++) {
+            const TrieNode* child = trieChild(node, (unsigned char)c);
+            if (child) queue[queued++] = child;
+        }
+    }
+    fprintf(out, "\n};\n\ninline constexpr int node_edges[] = {");
+    int num_edges = 0;
+    for (int n = 0; n < num_nodes; n++) {
+        emitArrayValue(out, n, num_edges);
+        num_edges += queue[n]->num_children;
+    }
+    emitArrayValue(out, num_nodes, num_edges);
+    fprintf(out, "\n};\n\ninline constexpr unsigned char edge_byte[] = {");
+    int e = 0;
+    for (int n = 0; n < num_nodes; n++) {
+        for (int c = 0; c < 256; c++) {
+            if (trieChild(queue[n], (unsigned char)c)) emitArrayValue(out, e++, c);
+        }
+    }
+    fprintf(out, "\n};\n\ninline constexpr int edge_target[] = {");
+    e = 0;
+    int target = 1;
+    for (int n = 0; n < num_nodes; n++) {
+        for (int c = 0; c < 256; c++) {
+            if (trieChild(queue[n], (unsigned char)c)) emitArrayValue(out, e++, target++);
+        }
+    }
+
+    fprintf(out, "\n};\n\ninline constexpr int token_id[] = {");
+    int num_tokens = 0;
+    for (int id = 0; id <= tokenizer->max_token_id; id++) {
+        if (tokenizer->token_length[id] != -1) emitArrayValue(out, num_tokens++, id);
+    }
+    fprintf(out, "\n};\n\ninline constexpr int token_offset[] = {");
+    int offset = 0;
+    num_tokens = 0;
+    for (int id = 0; id <= tokenizer->max_token_id; id++) {
+        if (tokenizer->token_length[id] == -1) continue;
+        emitArrayValue(out, num_tokens++, offset);
+        offset += tokenizer->token_length[id];
+    }
+    emitArrayValue(out, num_tokens, offset);
+    fprintf(out, "\n};\n\ninline constexpr unsigned char token_bytes[] = {");
+    offset = 0;
+    for (int id = 0; id <= tokenizer->max_token_id; id++) {
+        const unsigned char* token = tokenizer->token_data + tokenizer->token_offset[id];
+        for (int i = 0; i < tokenizer->token_length[id]; i++) {
+            emitArrayValue(out, offset++, token[i]);
+        }
+    }
+    if (offset == 0) emitArrayValue(out, 0, 0);
+    fprintf(out, "\n};\n\ninline constexpr int num_tokens = %d;\n\n", num_tokens);
+    fprintf(out, "}  // namespace rwkv::compiled\n");
+    free(queue);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* program = argv[0];
+    bool constexpr_mode = argc > 1 && strcmp(argv[1], "--constexpr") == 0;
+    if (constexpr_mode) {
+        argv++;
+        argc--;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <vocab> [sample] > rwkv_matcher_gen.c\n"
+                        "       %s --constexpr <vocab> > rwkv_vocab_constexpr.hpp\n", program, program);
+        return 1;
+    }
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, argv[1]) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+
+    int num_nodes = countNodes(tokenizer->root);
+    if (constexpr_mode) {
+        int status = emitConstexpr(stdout, tokenizer, num_nodes);
+        fprintf(stderr, "Generated constexpr vocabulary for %d tokens (%d trie nodes)\n", tokenizer->num_tokens, num_nodes);
+        freeTokenizer(tokenizer);
+        return status == 0 ? 0 : 1;
+    }
+    nodes.capacity = 1;
+    while (nodes.capacity < (size_t)num_nodes * 2) nodes.capacity <<= 1;
+    nodes.slots = (NodeSlot*)calloc(nodes.capacity, sizeof(NodeSlot));
+    heat = (uint64_t*)calloc(nodes.capacity, sizeof(uint64_t));
+    if (!nodes.slots || !heat) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    subtreeTokens(tokenizer->root);
+
+    if (argc > 2) {
+        FILE* file = fopen(argv[2], "rb");
+        if (!file) {
+            fprintf(stderr, "Failed to open sample file: %s\n", argv[2]);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        unsigned char* sample = (unsigned char*)malloc(length > 0 ? length : 1);
+        if (!sample || fread(sample, 1, length, file) != (size_t)length) {
+            fprintf(stderr, "Failed to read sample file: %s\n", argv[2]);
+            return 1;
+        }
+        fclose(file);
+        profileSample(tokenizer, sample, length);
+        free(sample);
+    }
+
+    emitMatcher(stdout, tokenizer);
+    fprintf(stderr, "Generated matcher for %d tokens (%d trie nodes)\n", tokenizer->num_tokens, num_nodes);
+
+    free(nodes.slots);
+    free(heat);
+    freeTokenizer(tokenizer);
+    return 0;
+}
@@ -0,0 +1,692 @@
+// HTTP/1.1 tokenizer server on edge-triggered epoll, one worker per core.
+//
+//   gcc -O2 -DRWKV_TOKENIZER_NO_MAIN rwkv_http.c rwkv_metrics.c rwkv_tokenizer.c -o rwkv_http -pthread
+//   ./rwkv_http [-v vocab] [-p port] [-t workers]
+//
+//   POST /encode    body: raw bytes         -> little-endian uint32 ids
+//   POST /decode    body: little-endian uint32 ids, or a JSON array with
+//                   Content-Type: application/json -> raw bytes
+//   GET  /metrics   Prometheus text format
+//   GET  /health
+//
+// /encode answers with a JSON array instead when the query has format=json
+// or the Accept header asks for application/json. Connections are
+// keep-alive and requests may be pipelined; chunked request bodies are not
+// supported. Each worker owns its own SO_REUSEPORT listener and epoll set,
+// so workers share nothing but the read-only tokenizer and are never woken
+// for another worker's connection.
+
+#define _GNU_SOURCE  // memmem, accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "rwkv_tokenizer.h"
+#include "rwkv_metrics.h"
+#include "rwkv_wire.h"
+
+#define DEFAULT_PORT 8080
+#define MAX_HEADER_BYTES 8192
+#define MAX_BODY_BYTES (64 << 20)
+#define MAX_REQUEST_BYTES (MAX_HEADER_BYTES + MAX_BODY_BYTES)
+#define READ_CHUNK 65536
+#define MAX_EVENTS 256
+
+// A response in the output buffer whose latency is observed once the
+// buffer has been written up to `end`.
+typedef struct {
+    size_t end;
+    double start;
+} PendingResponse;
+
+typedef struct {
+    struct HttpWorker* worker;
+    int fd;
+    char* in;
+    size_t in_length;
+    size_t in_capacity;
+    char* out;
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    bool close_after;  // close once the output has been flushed
+    bool peer_closed;
+    bool continue_sent;  // 100 Continue already sent for the request being read
+    PendingResponse* pending;
+    size_t num_pending;
+    size_t pending_sent;  // pending[0 .. pending_sent) have been observed
+    size_t pending_capacity;
+} HttpConnection;
+
+typedef struct HttpWorker {
+    Tokenizer* tokenizer;
+    Metrics* metrics;
+    int port;
+    int index;
+    int listener;
+    int epoll_fd;
+    bool accept_paused;  // out of descriptors; resumed when a connection closes
+    MetricsShard* shard;
+    int* ids;  // scratch for encode results and decode input
+    size_t ids_capacity;
+} HttpWorker;
+
+typedef struct {
+    const char* method;
+    int method_length;
+    const char* path;
+    int path_length;
+    const char* query;
+    int query_length;
+    const char* body;
+    size_t body_length;
+    bool keep_alive;
+    bool json_body;
+    bool wants_json;
+} HttpRequest;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* growBuffer(void* buffer, size_t* capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) return buffer;
+    size_t grown = *capacity ? *capacity : 4096;
+    while (grown < needed) grown *= 2;
+    buffer = realloc(buffer, grown * element_size);
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return buffer;
+}
+
+// Gives memory back after an unusually large request, so it is not held
+// for the rest of a keep-alive connection or the worker's life. The first
+// `keep` elements survive.
+static void* shrinkBuffer(void* buffer, size_t* capacity, size_t keep, size_t element_size) {
+    if (*capacity <= keep) return buffer;
+    void* shrunk = realloc(buffer, keep * element_size);
+    if (!shrunk) return buffer;
+    *capacity = keep;
+    return shrunk;
+}
+
+static char* reserveOutput(HttpConnection* connection, size_t length) {
+    connection->out = (char*)growBuffer(connection->out, &connection->out_capacity, connection->out_length + length, 1);
+    return connection->out + connection->out_length;
+}
+
+static void appendOutput(HttpConnection* connection, const void* data, size_t length) {
+    memcpy(reserveOutput(connection, length), data, length);
+    connection->out_length += length;
+}
+
+static void appendHeader(HttpConnection* connection, const char* status, const char* content_type, size_t length,
+                         bool keep_alive) {
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n", status,
+                                 content_type, length, keep_alive ? "" : "Connection: close\r\n");
+    appendOutput(connection, header, header_length);
+}
+
+static void respondText(HttpConnection* connection, const char* status, const char* text, bool keep_alive) {
+    size_t length = strlen(text);
+    appendHeader(connection, status, "text/plain", length, keep_alive);
+    appendOutput(connection, text, length);
+    if (!keep_alive) connection->close_after = true;
+}
+
+static bool headerIs(const char* name, int name_length, const char* expected) {
+    return name_length == (int)strlen(expected) && strncasecmp(name, expected, name_length) == 0;
+}
+
+static bool valueContains(const char* value, int value_length, const char* needle) {
+    int needle_length = strlen(needle);
+    for (int i = 0; i + needle_length <= value_length; i++) {
+        if (strncasecmp(value + i, needle, needle_length) == 0) return true;
+    }
+    return false;
+}
+
+static bool queryContains(const HttpRequest* request, const char* needle) {
+    return request->query && valueContains(request->query, request->query_length, needle);
+}
+
+static void handleEncode(HttpWorker* worker, HttpConnection* connection, const HttpRequest* request) {
+    worker->ids = (int*)growBuffer(worker->ids, &worker->ids_capacity, request->body_length + 1, sizeof(int));
+    int count = encodeInto(worker->tokenizer, request->body, (int)request->body_length, worker->ids);
+    metricsAdd(worker->shard, METRIC_ENCODED_BYTES, request->body_length);
+    metricsAdd(worker->shard, METRIC_ENCODED_TOKENS, count);
+
+    if (request->wants_json || queryContains(request, "format=json")) {
+        // Reserve room for the header plus the worst case of 11 bytes per
+        // id, then write the header once the body length is known.
+        char* body = reserveOutput(connection, 256 + (size_t)count * 11 + 3) + 256;
+        size_t length = 0;
+        body[length++] = '[';
+        for (int i = 0; i < count; i++) {
+            if (i > 0) body[length++] = ',';
+            char digits[12];
+            int num_digits = 0;
+            unsigned int id = (unsigned int)worker->ids[i];
+            do {
+                digits[num_digits++] = (char)('0' + id % 10);
+                id /= 10;
+            } while (id > 0);
+            while (num_digits > 0) body[length++] = digits[--num_digits];
+        }
+        body[length++] = ']';
+        body[length++] = '\n';
+        char header[256];
+        int header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n%s\r\n",
+                                     length, request->keep_alive ? "" : "Connection: close\r\n");
+        memcpy(connection->out + connection->out_length, header, header_length);
+        memmove(connection->out + connection->out_length + header_length, body, length);
+        connection->out_length += header_length + length;
+    } else {
+        appendHeader(connection, "200 OK", "application/octet-stream", (size_t)count * sizeof(uint32_t),
+                     request->keep_alive);
+        appendOutput(connection, idsToWire(worker->ids), (size_t)count * sizeof(uint32_t));
+    }
+}
+
+// Parses "[1, 2, 3]" into worker->ids. Returns the count, or -1.
+static int parseJsonIds(HttpWorker* worker, const char* body, size_t length) {
+    worker->ids = (int*)growBuffer(worker->ids, &worker->ids_capacity, length / 2 + 1, sizeof(int));
+    size_t i = 0;
+    while (i < length && (body[i] == ' ' || body[i] == '\t' || body[i] == '\r' || body[i] == '\n')) i++;
+    if (i == length || body[i++] != '[') return -1;
+    int count = 0;
+    bool expect_value = true;
+    bool first = true;
+    for (; i < length; i++) {
+        char c = body[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+        if (c == ']' && (!expect_value || first)) return count;
+        if (expect_value && c >= '0' && c <= '9') {
+            long long value = 0;
+            while (i < length && body[i] >= '0' && body[i] <= '9') {
+                value = value * 10 + (body[i++] - '0');
+                if (value > INT32_MAX) return -1;
+            }
+            i--;
+            worker->ids[count++] = (int)value;
+            expect_value = false;
+            first = false;
+        } else if (!expect_value && c == ',') {
+            expect_value = true;
+        } else {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void handleDecode(HttpWorker* worker, HttpConnection* connection, const HttpRequest* request) {
+    int count;
+    if (request->json_body) {
+        count = parseJsonIds(worker, request->body, request->body_length);
+        if (count < 0) {
+            respondText(connection, "400 Bad Request", "expected a JSON array of token ids\n", request->keep_alive);
+            return;
+        }
+    } else {
+        if (request->body_length % sizeof(uint32_t) != 0) {
+            respondText(connection, "400 Bad Request", "body is not a whole number of uint32 ids\n", request->keep_alive);
+            return;
+        }
+        count = (int)(request->body_length / sizeof(uint32_t));
+        worker->ids = (int*)growBuffer(worker->ids, &worker->ids_capacity, count + 1, sizeof(int));
+        idsFromWire(worker->ids, request->body, count);
+    }
+    // Validate and size first, so an unknown id is a 400 rather than a
+    // half-written response.
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        int token_length;
+        if (!tokenBytes(worker->tokenizer, worker->ids[i], &token_length)) {
+            respondText(connection, "400 Bad Request", "unknown token id\n", request->keep_alive);
+            return;
+        }
+        length += token_length;
+    }
+    if (length > INT32_MAX) {
+        respondText(connection, "413 Payload Too Large", "decoded output too large\n", request->keep_alive);
+        return;
+    }
+    appendHeader(connection, "200 OK", "application/octet-stream", length, request->keep_alive);
+    char* out = reserveOutput(connection, length);
+    decodeInto(worker->tokenizer, worker->ids, count, out, (int)length);
+    connection->out_length += length;
+    metricsAdd(worker->shard, METRIC_DECODED_TOKENS, count);
+    metricsAdd(worker->shard, METRIC_DECODED_BYTES, length);
+}
+
+static void handleMetrics(HttpWorker* worker, HttpConnection* connection, const HttpRequest* request) {
+    MetricsSnapshot snapshot;
+    metricsSnapshot(worker->metrics, &snapshot);
+    char* body = NULL;
+    size_t length = 0;
+    FILE* out = open_memstream(&body, &length);
+    metricsWritePrometheus(&snapshot, out);
+    fclose(out);
+    appendHeader(connection, "200 OK", "text/plain; version=0.0.4", length, request->keep_alive);
+    appendOutput(connection, body, length);
+    free(body);
+}
+
+// Returns true for /encode and /decode, whose latency is recorded.
+static bool handleRequest(HttpWorker* worker, HttpConnection* connection, const HttpRequest* request) {
+    bool post = request->method_length == 4 && memcmp(request->method, "POST", 4) == 0;
+    bool get = request->method_length == 3 && memcmp(request->method, "GET", 3) == 0;
+    bool timed = false;
+    if (headerIs(request->path, request->path_length, "/encode")) {
+        if (!post) {
+            respondText(connection, "405 Method Not Allowed", "use POST\n", request->keep_alive);
+            return false;
+        }
+        metricsAdd(worker->shard, METRIC_REQUESTS, 1);
+        handleEncode(worker, connection, request);
+        timed = true;
+    } else if (headerIs(request->path, request->path_length, "/decode")) {
+        if (!post) {
+            respondText(connection, "405 Method Not Allowed", "use POST\n", request->keep_alive);
+            return false;
+        }
+        metricsAdd(worker->shard, METRIC_REQUESTS, 1);
+        handleDecode(worker, connection, request);
+        timed = true;
+    } else if (get && headerIs(request->path, request->path_length, "/metrics")) {
+        handleMetrics(worker, connection, request);
+    } else if (get && headerIs(request->path, request->path_length, "/health")) {
+        respondText(connection, "200 OK", "ok\n", request->keep_alive);
+    } else {
+        respondText(connection, "404 Not Found", "not found\n", request->keep_alive);
+    }
+    if (!request->keep_alive) connection->close_after = true;
+    return timed;
+}
+
+// Handles one complete request at the start of `data`. Returns the bytes
+// consumed, 0 if more input is needed, or -1 after queueing an error
+// response that closes the connection.
+static long parseRequest(HttpWorker* worker, HttpConnection* connection, const char* data, size_t available) {
+    // Only the first MAX_HEADER_BYTES can hold the terminator, so a request
+    // never needs more than MAX_REQUEST_BYTES of input.
+    size_t window = available < MAX_HEADER_BYTES ? available : MAX_HEADER_BYTES;
+    const char* end = (const char*)memmem(data, window, "\r\n\r\n", 4);
+    if (!end) {
+        if (available >= MAX_HEADER_BYTES) {
+            respondText(connection, "431 Request Header Fields Too Large", "headers too large\n", false);
+            return -1;
+        }
+        return 0;
+    }
+    size_t header_length = end + 4 - data;
+
+    HttpRequest request;
+    memset(&request, 0, sizeof(request));
+    const char* line_end = (const char*)memmem(data, header_length, "\r\n", 2);
+    const char* space = (const char*)memchr(data, ' ', line_end - data);
+    const char* target_end = space ? (const char*)memchr(space + 1, ' ', line_end - space - 1) : NULL;
+    if (!space || !target_end || line_end - target_end < 9 || memcmp(target_end + 1, "HTTP/1.", 7) != 0) {
+        respondText(connection, "400 Bad Request", "malformed request line\n", false);
+        return -1;
+    }
+    request.method = data;
+    request.method_length = space - data;
+    request.path = space + 1;
+    request.path_length = target_end - request.path;
+    const char* question = (const char*)memchr(request.path, '?', request.path_length);
+    if (question) {
+        request.query = question + 1;
+        request.query_length = target_end - request.query;
+        request.path_length = question - request.path;
+    }
+    bool http11 = target_end[8] == '1';
+    request.keep_alive = http11;  // HTTP/1.1 defaults to keep-alive
+    bool expects_continue = false;
+
+    long long content_length = -1;
+    for (const char* line = line_end + 2; line < end; line = line_end + 2) {
+        line_end = (const char*)memmem(line, end + 2 - line, "\r\n", 2);
+        const char* colon = (const char*)memchr(line, ':', line_end - line);
+        if (!colon) continue;
+        const char* value = colon + 1;
+        while (value < line_end && (*value == ' ' || *value == '\t')) value++;
+        int name_length = colon - line;
+        int value_length = line_end - value;
+        if (headerIs(line, name_length, "Content-Length")) {
+            // The body framing depends on it, so anything but one decimal
+            // value (repeats must agree) is rejected rather than guessed at.
+            while (value_length > 0 && (value[value_length - 1] == ' ' || value[value_length - 1] == '\t')) {
+                value_length--;
+            }
+            long long parsed = 0;
+            bool valid = value_length > 0;
+            for (int i = 0; i < value_length && valid; i++) {
+                valid = value[i] >= '0' && value[i] <= '9';
+                if (parsed <= MAX_BODY_BYTES) parsed = parsed * 10 + (value[i] - '0');
+            }
+            if (!valid || (content_length >= 0 && parsed != content_length)) {
+                respondText(connection, "400 Bad Request", "invalid Content-Length\n", false);
+                return -1;
+            }
+            content_length = parsed;
+        } else if (headerIs(line, name_length, "Transfer-Encoding")) {
+            respondText(connection, "501 Not Implemented", "chunked bodies are not supported\n", false);
+            return -1;
+        } else if (headerIs(line, name_length, "Connection")) {
+            if (valueContains(value, value_length, "close")) request.keep_alive = false;
+            if (valueContains(value, value_length, "keep-alive")) request.keep_alive = true;
+        } else if (headerIs(line, name_length, "Content-Type")) {
+            request.json_body = valueContains(value, value_length, "application/json");
+        } else if (headerIs(line, name_length, "Accept")) {
+            request.wants_json = valueContains(value, value_length, "application/json");
+        } else if (headerIs(line, name_length, "Expect")) {
+            expects_continue = valueContains(value, value_length, "100-continue");
+        }
+    }
+    if (content_length < 0) content_length = 0;
+    if (content_length > MAX_BODY_BYTES) {
+        respondText(connection, "413 Payload Too Large", "body too large\n", false);
+        return -1;
+    }
+    if (available < header_length + content_length) {
+        // curl waits up to a second for this before sending large bodies.
+        if (expects_continue && http11 && !connection->continue_sent) {
+            static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            appendOutput(connection, interim, sizeof(interim) - 1);
+            connection->continue_sent = true;
+        }
+        return 0;
+    }
+    connection->continue_sent = false;
+    request.body = data + header_length;
+    request.body_length = (size_t)content_length;
+
+    double start = now();
+    bool timed = handleRequest(worker, connection, &request);
+    worker->ids = (int*)shrinkBuffer(worker->ids, &worker->ids_capacity, READ_CHUNK, sizeof(int));
+    if (timed) {
+        connection->pending = (PendingResponse*)growBuffer(connection->pending, &connection->pending_capacity,
+                                                           connection->num_pending + 1, sizeof(PendingResponse));
+        connection->pending[connection->num_pending].end = connection->out_length;
+        connection->pending[connection->num_pending].start = start;
+        connection->num_pending++;
+    }
+    return (long)(header_length + content_length);
+}
+
+static void armListener(HttpWorker* worker, uint32_t events) {
+    // The listener's data.ptr is NULL; connections carry their state.
+    struct epoll_event event = {.events = events, .data.ptr = NULL};
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, worker->listener, &event);
+}
+
+static void closeConnection(HttpConnection* connection) {
+    HttpWorker* worker = connection->worker;
+    close(connection->fd);
+    free(connection->in);
+    free(connection->out);
+    free(connection->pending);
+    free(connection);
+    // Re-arming an edge-triggered descriptor reports it again if it is
+    // ready, so connections that queued while we were out of descriptors
+    // get accepted now.
+    if (worker->accept_paused) {
+        worker->accept_paused = false;
+        armListener(worker, EPOLLIN | EPOLLET);
+    }
+}
+
+// Latency runs from a request being read to its response being written.
+static void observeSent(HttpConnection* connection) {
+    while (connection->pending_sent < connection->num_pending &&
+           connection->pending[connection->pending_sent].end <= connection->out_sent) {
+        metricsObserveLatency(connection->worker->shard, now() - connection->pending[connection->pending_sent].start);
+        connection->pending_sent++;
+    }
+}
+
+// Returns false once the connection has been closed.
+static bool flushOutput(HttpConnection* connection) {
+    while (connection->out_sent < connection->out_length) {
+        ssize_t n = write(connection->fd, connection->out + connection->out_sent,
+                          connection->out_length - connection->out_sent);
+        if (n > 0) {
+            connection->out_sent += n;
+            observeSent(connection);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        closeConnection(connection);
+        return false;
+    }
+    observeSent(connection);
+    connection->out_length = connection->out_sent = 0;
+    connection->num_pending = connection->pending_sent = 0;
+    connection->out = (char*)shrinkBuffer(connection->out, &connection->out_capacity, 2 * READ_CHUNK, 1);
+    if (connection->close_after) {
+        closeConnection(connection);
+        return false;
+    }
+    return true;
+}
+
+// Edge-triggered: read until EAGAIN, answer every complete request, write
+// until EAGAIN, and repeat until both directions would block. Input is not
+// read while a response is still pending, which pushes back on pipelining
+// clients through TCP flow control.
+static void driveConnection(HttpWorker* worker, HttpConnection* connection) {
+    for (;;) {
+        bool drained = false;  // read hit EAGAIN or end of stream
+        while (connection->out_length == 0 && !connection->close_after && !connection->peer_closed) {
+            if (connection->in_length >= MAX_REQUEST_BYTES) break;
+            connection->in = (char*)growBuffer(connection->in, &connection->in_capacity,
+                                               connection->in_length + READ_CHUNK, 1);
+            ssize_t n = read(connection->fd, connection->in + connection->in_length,
+                             connection->in_capacity - connection->in_length);
+            if (n > 0) {
+                connection->in_length += n;
+            } else if (n == 0) {
+                connection->peer_closed = true;
+                drained = true;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                drained = true;
+                break;
+            } else if (errno != EINTR) {
+                closeConnection(connection);
+                return;
+            }
+        }
+
+        size_t offset = 0;
+        while (!connection->close_after) {
+            long used = parseRequest(worker, connection, connection->in + offset, connection->in_length - offset);
+            if (used <= 0) break;
+            offset += used;
+        }
+        if (offset > 0) {
+            memmove(connection->in, connection->in + offset, connection->in_length - offset);
+            connection->in_length -= offset;
+            if (connection->in_length <= READ_CHUNK) {
+                connection->in = (char*)shrinkBuffer(connection->in, &connection->in_capacity, 2 * READ_CHUNK, 1);
+            }
+        } else if (connection->in_length >= MAX_REQUEST_BYTES && !connection->close_after) {
+            // parseRequest() bounds every request below this, so a full
+            // buffer it cannot use would otherwise be read from forever.
+            respondText(connection, "413 Payload Too Large", "request too large\n", false);
+        }
+
+        if (!flushOutput(connection)) return;
+        if (connection->out_length > 0) return;  // socket full; EPOLLOUT resumes us
+        if (connection->peer_closed) {
+            closeConnection(connection);
+            return;
+        }
+        if (drained) return;
+    }
+}
+
+static int openListener(int port) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)port);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 4096) != 0) {
+        fprintf(stderr, "Failed to listen on port %d: %s\n", port, strerror(errno));
+        if (listener >= 0) close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+static void* runWorker(void* arg) {
+    HttpWorker* worker = (HttpWorker*)arg;
+    worker->shard = metricsAcquireShard(worker->metrics);
+    int listener = openListener(worker->port);
+    int epoll_fd = epoll_create1(0);
+    if (listener < 0 || epoll_fd < 0) exit(1);
+    worker->listener = listener;
+    worker->epoll_fd = epoll_fd;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLET, .data.ptr = NULL};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+    struct epoll_event events[MAX_EVENTS];
+    int one = 1;
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "epoll_wait failed in worker %d: %s\n", worker->index, strerror(errno));
+            exit(1);
+        }
+        for (int i = 0; i < ready; i++) {
+            HttpConnection* connection = (HttpConnection*)events[i].data.ptr;
+            if (connection) {
+                driveConnection(worker, connection);
+                continue;
+            }
+            while (!worker->accept_paused) {
+                int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    if (errno == EMFILE || errno == ENFILE) {
+                        // Nothing would report the listener again until a new
+                        // connection arrives, so stop watching it until one
+                        // of ours closes (see closeConnection()).
+                        worker->accept_paused = true;
+                        armListener(worker, 0);
+                    }
+                    break;
+                }
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                connection = (HttpConnection*)calloc(1, sizeof(HttpConnection));
+                if (!connection) {
+                    fprintf(stderr, "Memory allocation failed\n");
+                    exit(1);
+                }
+                connection->worker = worker;
+                connection->fd = fd;
+                struct epoll_event connection_event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                                                       .data.ptr = connection};
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &connection_event);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-v vocab] [-p port] [-t workers]\n", program);
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = "rwkv_vocab_v20230424.txt";
+    int port = DEFAULT_PORT;
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            vocab = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            num_workers = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (num_workers < 1) num_workers = 1;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+    Metrics* metrics = createMetrics();
+    HttpWorker* workers = (HttpWorker*)calloc(num_workers, sizeof(HttpWorker));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (int w = 0; w < num_workers; w++) {
+        workers[w].tokenizer = tokenizer;
+        workers[w].metrics = metrics;
+        workers[w].port = port;
+        workers[w].index = w;
+        pthread_t thread;
+        pthread_create(&thread, NULL, runWorker, &workers[w]);
+        pthread_detach(thread);
+    }
+    fprintf(stderr, "Listening on port %d with %d workers\n", port, num_workers);
+
+    double start = now();
+    for (;;) {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0) continue;
+        MetricsSnapshot snapshot;
+        metricsSnapshot(metrics, &snapshot);
+        double elapsed = now() - start;
+        fprintf(stderr, "summary workers=%d requests=%lld encoded_bytes=%lld encoded_tokens=%lld decoded_tokens=%lld "
+                "decoded_bytes=%lld p50_ms=%.3f p99_ms=%.3f seconds=%.1f\n",
+                num_workers, snapshot.counters[METRIC_REQUESTS], snapshot.counters[METRIC_ENCODED_BYTES],
+                snapshot.counters[METRIC_ENCODED_TOKENS], snapshot.counters[METRIC_DECODED_TOKENS],
+                snapshot.counters[METRIC_DECODED_BYTES], metricsLatencyQuantile(&snapshot, 0.5) * 1e3,
+                metricsLatencyQuantile(&snapshot, 0.99) * 1e3, elapsed);
+        if (signal_number != SIGUSR1) break;
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+// Closed-loop load generator for rwkv_server.
+//
+//   gcc -O2 rwkv_loadgen.c -o rwkv_loadgen -pthread
+//   ./rwkv_loadgen [-h host] [-p port] [-c connections] [-n bytes] [-s seconds] [-i input] [-d ms] [--http]
+//
+// Each connection sends a request, waits for the ids and sends the next.
+// Requests are slices of the input with a unique sequence number written
+// over their first bytes, so the server cannot collapse them. Prints
+// requests/s, MB/s and latency percentiles; run it against -w 1, 2, 4, ...
+// to check how the server scales with worker processes. -d gives every
+// request a deadline; rejected requests are counted and the connection
+// carries on, and goodput counts answers that arrived in time. --http sends
+// keep-alive POST /encode requests to rwkv_http instead.
+
+#define _GNU_SOURCE  // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define HAS_DEADLINE 0x80000000u
+#define REJECTED 0xFFFFFFFFu
+
+static const char* builtin_sample =
+    "The quick brown fox jumps over the lazy dog. It is given that $t$ is a common root of the "
+    "following two equations, where $a,b,c,d,e$ are real numbers.\n"
+    "我们今天在这里讨论一个问题，这个问题对所有人都很重要。日本語のテキストも少し含めます。\n"
+    "    for (int i = 0; i < n; i++) { total += values[i] * weights[i]; }\n";
+
+typedef struct {
+    const char* host;
+    int port;
+    int request_bytes;
+    int deadline_ms;  // 0 for none
+    bool http;
+    double end;
+    const char* data;
+    int data_length;
+    atomic_llong sequence;
+    atomic_int failed;
+} Load;
+
+typedef struct {
+    Load* load;
+    int seed;
+    long long requests;
+    long long rejected;
+    long long late;  // answered after the deadline
+    long long tokens;
+    double* latencies;
+    long long num_latencies;
+    long long latency_capacity;
+} Client;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool readFull(int fd, void* buffer, size_t length) {
+    char* ptr = (char*)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, ptr, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buffer, size_t length) {
+    const char* ptr = (const char*)buffer;
+    while (length > 0) {
+        ssize_t n = write(fd, ptr, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Reads one keep-alive response and returns the number of ids in its body,
+// or -1. Requests are not pipelined, so nothing follows the body.
+static long long readHttpResponse(int fd, char* buffer, size_t capacity) {
+    size_t length = 0;
+    char* end = NULL;
+    while (!end) {
+        if (length == capacity) return -1;
+        ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        length += n;
+        end = (char*)memmem(buffer, length, "\r\n\r\n", 4);
+    }
+    size_t header_length = end + 4 - buffer;
+    if (length < 12 || memcmp(buffer, "HTTP/1.1 200", 12) != 0) return -1;
+    char* field = (char*)memmem(buffer, header_length, "Content-Length:", 15);
+    if (!field) return -1;
+    size_t body_length = strtoull(field + 15, NULL, 10);
+    if (header_length + body_length > capacity) return -1;
+    if (!readFull(fd, buffer + length, header_length + body_length - length)) return -1;
+    return (long long)(body_length / sizeof(uint32_t));
+}
+
+static void* runClient(void* arg) {
+    Client* client = (Client*)arg;
+    Load* load = client->load;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)load->port);
+    inet_pton(AF_INET, load->host, &address.sin_addr);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Failed to connect to %s:%d: %s\n", load->host, load->port, strerror(errno));
+        atomic_store(&load->failed, 1);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int length = load->request_bytes;
+    char header[128];
+    int header_length;
+    if (load->http) {
+        header_length = snprintf(header, sizeof(header), "POST /encode HTTP/1.1\r\nHost: %s\r\nContent-Length: %d\r\n\r\n",
+                                 load->host, length);
+    } else if (load->deadline_ms > 0) {
+        uint32_t prefix[2] = {(uint32_t)length | HAS_DEADLINE, (uint32_t)load->deadline_ms};
+        memcpy(header, prefix, sizeof(prefix));
+        header_length = sizeof(prefix);
+    } else {
+        uint32_t prefix = (uint32_t)length;
+        memcpy(header, &prefix, sizeof(prefix));
+        header_length = sizeof(prefix);
+    }
+    size_t response_capacity = 1024 + (size_t)length * sizeof(uint32_t);
+    char* request = (char*)malloc(header_length + length);
+    uint32_t* ids = (uint32_t*)malloc(response_capacity);
+    if (!request || !ids) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(request, header, header_length);
+    unsigned int seed = (unsigned int)client->seed;
+
+    while (now() < load->end) {
+        int offset = load->data_length > length ? rand_r(&seed) % (load->data_length - length) : 0;
+        memcpy(request + header_length, load->data + offset, length);
+        char tag[24];
+        int tag_length = snprintf(tag, sizeof(tag), "%016llx ", (long long)atomic_fetch_add(&load->sequence, 1));
+        memcpy(request + header_length, tag, tag_length < length ? tag_length : length);
+
+        double start = now();
+        long long count = -1;
+        if (writeFull(fd, request, header_length + length)) {
+            if (load->http) {
+                count = readHttpResponse(fd, (char*)ids, response_capacity);
+            } else {
+                uint32_t prefix;
+                bool answered = readFull(fd, &prefix, sizeof(prefix));
+                if (answered && prefix == REJECTED) {
+                    client->rejected++;
+                    continue;
+                }
+                if (answered && prefix <= (uint32_t)length && readFull(fd, ids, prefix * sizeof(uint32_t))) {
+                    count = prefix;
+                }
+            }
+        }
+        if (count < 0) {
+            fprintf(stderr, "Connection to %s:%d failed\n", load->host, load->port);
+            atomic_store(&load->failed, 1);
+            break;
+        }
+        if (client->num_latencies == client->latency_capacity) {
+            client->latency_capacity = client->latency_capacity ? client->latency_capacity * 2 : 1024;
+            client->latencies = (double*)realloc(client->latencies, client->latency_capacity * sizeof(double));
+            if (!client->latencies) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        double latency = now() - start;
+        client->latencies[client->num_latencies++] = latency;
+        client->requests++;
+        if (load->deadline_ms > 0 && latency * 1e3 > load->deadline_ms) client->late++;
+        client->tokens += count;
+    }
+    free(ids);
+    free(request);
+    close(fd);
+    return NULL;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-n bytes] [-s seconds] [-i input] [-d ms] [--http]\n", program);
+}
+
+int main(int argc, char** argv) {
+    const char* host = "127.0.0.1";
+    const char* input = NULL;
+    int port = 8765;
+    int connections = 64;
+    int request_bytes = 1024;
+    double seconds = 5;
+    int deadline_ms = 0;
+    bool http = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            host = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            request_bytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            input = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            deadline_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--http") == 0) {
+            http = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (connections < 1 || request_bytes < 1 || deadline_ms < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (deadline_ms > 0 && http) {
+        fprintf(stderr, "-d needs the binary protocol; rwkv_http has no deadlines\n");
+        return 1;
+    }
+
+    char* data;
+    int data_length;
+    if (input) {
+        FILE* file = fopen(input, "rb");
+        if (!file) {
+            fprintf(stderr, "Failed to open input file: %s\n", input);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        data_length = (int)ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = (char*)malloc(data_length > 0 ? data_length : 1);
+        if (!data || fread(data, 1, data_length, file) != (size_t)data_length) {
+            fprintf(stderr, "Failed to read input file: %s\n", input);
+            return 1;
+        }
+        fclose(file);
+    } else {
+        int sample_length = strlen(builtin_sample);
+        int copies = (request_bytes + (1 << 20)) / sample_length + 1;
+        data_length = sample_length * copies;
+        data = (char*)malloc(data_length);
+        if (!data) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < copies; i++) {
+            memcpy(data + i * sample_length, builtin_sample, sample_length);
+        }
+    }
+    if (data_length < request_bytes) {
+        fprintf(stderr, "Input is shorter than the request size\n");
+        return 1;
+    }
+
+    Load load;
+    memset(&load, 0, sizeof(load));
+    load.host = host;
+    load.port = port;
+    load.request_bytes = request_bytes;
+    load.deadline_ms = deadline_ms;
+    load.http = http;
+    load.data = data;
+    load.data_length = data_length;
+    Client* clients = (Client*)calloc(connections, sizeof(Client));
+    pthread_t* threads = (pthread_t*)malloc(connections * sizeof(pthread_t));
+    if (!clients || !threads) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    double start = now();
+    load.end = start + seconds;
+    for (int c = 0; c < connections; c++) {
+        clients[c].load = &load;
+        clients[c].seed = c + 1;
+        pthread_create(&threads[c], NULL, runClient, &clients[c]);
+    }
+    long long requests = 0;
+    long long rejected = 0;
+    long long late = 0;
+    long long tokens = 0;
+    long long num_latencies = 0;
+    for (int c = 0; c < connections; c++) {
+        pthread_join(threads[c], NULL);
+        requests += clients[c].requests;
+        rejected += clients[c].rejected;
+        late += clients[c].late;
+        tokens += clients[c].tokens;
+        num_latencies += clients[c].num_latencies;
+    }
+    double elapsed = now() - start;
+
+    double* latencies = (double*)malloc((num_latencies > 0 ? num_latencies : 1) * sizeof(double));
+    if (!latencies) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    long long n = 0;
+    for (int c = 0; c < connections; c++) {
+        memcpy(latencies + n, clients[c].latencies, clients[c].num_latencies * sizeof(double));
+        n += clients[c].num_latencies;
+        free(clients[c].latencies);
+    }
+    qsort(latencies, n, sizeof(double), compareDoubles);
+    double p50 = n > 0 ? latencies[n / 2] : 0;
+    double p99 = n > 0 ? latencies[n * 99 / 100] : 0;
+    printf("summary connections=%d request_bytes=%d deadline_ms=%d requests=%lld rejected=%lld late=%lld "
+           "requests_per_sec=%.0f goodput_per_sec=%.0f mb_per_sec=%.1f tokens_per_sec=%.0f p50_ms=%.3f p99_ms=%.3f "
+           "seconds=%.1f\n",
+           connections, request_bytes, deadline_ms, requests, rejected, late, requests / elapsed,
+           (requests - late) / elapsed, requests * (double)request_bytes / elapsed / 1e6, tokens / elapsed, p50 * 1e3,
+           p99 * 1e3, elapsed);
+
+    free(latencies);
+    free(threads);
+    free(clients);
+    free(data);
+    return atomic_load(&load.failed) ? 1 : 0;
+}
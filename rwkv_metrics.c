@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rwkv_metrics.h"
+
+static const struct {
+    const char* name;
+    const char* help;
+} counter_info[NUM_METRIC_COUNTERS] = {
+    {"rwkv_requests_total", "Requests received."},
+    {"rwkv_encoded_bytes_total", "Input bytes encoded."},
+    {"rwkv_encoded_tokens_total", "Token ids produced by encoding."},
+    {"rwkv_decoded_tokens_total", "Token ids decoded."},
+    {"rwkv_decoded_bytes_total", "Bytes produced by decoding."},
+    {"rwkv_collapsed_requests_total", "Requests answered by a concurrent identical request's encode."},
+    {"rwkv_rejected_requests_total", "Requests rejected because they could not meet their deadline."},
+};
+
+Metrics* createMetrics(void) {
+    Metrics* metrics = (Metrics*)calloc(1, sizeof(Metrics));
+    if (!metrics) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pthread_mutex_init(&metrics->lock, NULL);
+    return metrics;
+}
+
+MetricsShard* metricsAcquireShard(Metrics* metrics) {
+    pthread_mutex_lock(&metrics->lock);
+    MetricsShard* shard = metrics->free_shards;
+    if (shard) {
+        metrics->free_shards = shard->next_free;
+    } else {
+        shard = (MetricsShard*)aligned_alloc(64, sizeof(MetricsShard));
+        if (!shard) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        memset(shard, 0, sizeof(MetricsShard));
+        shard->next = metrics->shards;
+        metrics->shards = shard;
+    }
+    pthread_mutex_unlock(&metrics->lock);
+    return shard;
+}
+
+void metricsReleaseShard(Metrics* metrics, MetricsShard* shard) {
+    pthread_mutex_lock(&metrics->lock);
+    shard->next_free = metrics->free_shards;
+    metrics->free_shards = shard;
+    pthread_mutex_unlock(&metrics->lock);
+}
+
+void metricsObserveLatency(MetricsShard* shard, double seconds) {
+    int bucket = 0;
+    double bound = METRICS_FIRST_BUCKET_SECONDS;
+    while (bucket < METRICS_LATENCY_BUCKETS && seconds > bound) {
+        bucket++;
+        bound *= 2;
+    }
+    atomic_llong* slot = &shard->latency_buckets[bucket];
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + 1, memory_order_relaxed);
+    long long ns = (long long)(seconds * 1e9);
+    atomic_store_explicit(&shard->latency_sum_ns,
+                          atomic_load_explicit(&shard->latency_sum_ns, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+}
+
+void metricsSnapshot(Metrics* metrics, MetricsSnapshot* out) {
+    memset(out, 0, sizeof(*out));
+    long long sum_ns = 0;
+    pthread_mutex_lock(&metrics->lock);
+    for (MetricsShard* shard = metrics->shards; shard; shard = shard->next) {
+        for (int i = 0; i < NUM_METRIC_COUNTERS; i++) {
+            out->counters[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        }
+        for (int i = 0; i <= METRICS_LATENCY_BUCKETS; i++) {
+            long long count = atomic_load_explicit(&shard->latency_buckets[i], memory_order_relaxed);
+            out->latency_buckets[i] += count;
+            out->latency_count += count;
+        }
+        sum_ns += atomic_load_explicit(&shard->latency_sum_ns, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&metrics->lock);
+    out->latency_sum = sum_ns * 1e-9;
+}
+
+double metricsLatencyQuantile(const MetricsSnapshot* snapshot, double quantile) {
+    if (snapshot->latency_count == 0) return 0;
+    double rank = quantile * snapshot->latency_count;
+    long long cumulative = 0;
+    double lower = 0;
+    double upper = METRICS_FIRST_BUCKET_SECONDS;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        long long count = snapshot->latency_buckets[i];
+        if (count > 0 && cumulative + count >= rank) {
+            return lower + (upper - lower) * (rank - cumulative) / count;
+        }
+        cumulative += count;
+        lower = upper;
+        upper *= 2;
+    }
+    return lower;  // in the open-ended bucket; report its lower bound
+}
+
+void metricsWritePrometheus(const MetricsSnapshot* snapshot, FILE* out) {
+    for (int i = 0; i < NUM_METRIC_COUNTERS; i++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %lld\n", counter_info[i].name, counter_info[i].help,
+                counter_info[i].name, counter_info[i].name, snapshot->counters[i]);
+    }
+
+    fprintf(out, "# HELP rwkv_request_latency_seconds Time from an encode or decode request being read to its response being written.\n"
+                 "# TYPE rwkv_request_latency_seconds histogram\n");
+    long long cumulative = 0;
+    double bound = METRICS_FIRST_BUCKET_SECONDS;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        cumulative += snapshot->latency_buckets[i];
+        fprintf(out, "rwkv_request_latency_seconds_bucket{le=\"%g\"} %lld\n", bound, cumulative);
+        bound *= 2;
+    }
+    fprintf(out, "rwkv_request_latency_seconds_bucket{le=\"+Inf\"} %lld\n", snapshot->latency_count);
+    fprintf(out, "rwkv_request_latency_seconds_sum %.9f\n", snapshot->latency_sum);
+    fprintf(out, "rwkv_request_latency_seconds_count %lld\n", snapshot->latency_count);
+
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    fprintf(out, "# HELP rwkv_request_latency_quantile_seconds Latency quantiles since start, estimated from the histogram.\n"
+                 "# TYPE rwkv_request_latency_quantile_seconds gauge\n");
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "rwkv_request_latency_quantile_seconds{quantile=\"%g\"} %.9f\n", quantiles[i],
+                metricsLatencyQuantile(snapshot, quantiles[i]));
+    }
+}
+
+void freeMetrics(Metrics* metrics) {
+    if (!metrics) return;
+    MetricsShard* shard = metrics->shards;
+    while (shard) {
+        MetricsShard* next = shard->next;
+        free(shard);
+        shard = next;
+    }
+    pthread_mutex_destroy(&metrics->lock);
+    free(metrics);
+}
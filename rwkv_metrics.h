@@ -0,0 +1,78 @@
+#ifndef RWKV_METRICS_H
+#define RWKV_METRICS_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latency bucket i has upper bound METRICS_FIRST_BUCKET_SECONDS * 2^i; one
+// more bucket holds everything slower.
+#define METRICS_LATENCY_BUCKETS 16
+#define METRICS_FIRST_BUCKET_SECONDS 50e-6
+
+typedef enum {
+    METRIC_REQUESTS,
+    METRIC_ENCODED_BYTES,
+    METRIC_ENCODED_TOKENS,
+    METRIC_DECODED_TOKENS,
+    METRIC_DECODED_BYTES,
+    METRIC_COLLAPSED,  // answered from another request's encode (see rwkv_singleflight.h)
+    METRIC_REJECTED,   // shed or expired by admission control
+    NUM_METRIC_COUNTERS
+} MetricCounter;
+
+// Counters written by one thread at a time, so updates are plain relaxed
+// load/store pairs with no locked instructions. Scrapes read them with
+// relaxed loads and may see a request half-counted, which is fine for
+// monotonic counters.
+typedef struct MetricsShard {
+    _Alignas(64) atomic_llong counters[NUM_METRIC_COUNTERS];
+    atomic_llong latency_buckets[METRICS_LATENCY_BUCKETS + 1];
+    atomic_llong latency_sum_ns;
+    struct MetricsShard* next;       // every shard, for scrapes
+    struct MetricsShard* next_free;  // shards not owned by a thread
+} MetricsShard;
+
+// Shards are never freed: a thread takes one with metricsAcquireShard() and
+// hands it back when done, keeping its totals, so the number of shards is
+// bounded by the peak number of concurrent threads.
+typedef struct {
+    pthread_mutex_t lock;
+    MetricsShard* shards;
+    MetricsShard* free_shards;
+} Metrics;
+
+typedef struct {
+    long long counters[NUM_METRIC_COUNTERS];
+    long long latency_buckets[METRICS_LATENCY_BUCKETS + 1];
+    long long latency_count;
+    double latency_sum;
+} MetricsSnapshot;
+
+Metrics* createMetrics(void);
+MetricsShard* metricsAcquireShard(Metrics* metrics);
+void metricsReleaseShard(Metrics* metrics, MetricsShard* shard);
+
+static inline void metricsAdd(MetricsShard* shard, MetricCounter counter, long long value) {
+    atomic_llong* slot = &shard->counters[counter];
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void metricsObserveLatency(MetricsShard* shard, double seconds);
+// Sums every shard; the only place shards are read by other threads.
+void metricsSnapshot(Metrics* metrics, MetricsSnapshot* out);
+// Latency quantile estimated from the histogram, interpolating within a bucket.
+double metricsLatencyQuantile(const MetricsSnapshot* snapshot, double quantile);
+// Prometheus text exposition (format 0.0.4) of the counters and histogram.
+void metricsWritePrometheus(const MetricsSnapshot* snapshot, FILE* out);
+void freeMetrics(Metrics* metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
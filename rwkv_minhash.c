@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rwkv_minhash.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define BIN_SHIFT 25  // 32 - log2(MINHASH_BINS)
+#define EMPTY_BIN 0xFFFFFFFFu
+#define FNV_PRIME 0x01000193u
+
+static inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint32_t probeBin(uint32_t seed, int bin, int attempt) {
+    return fmix32(seed ^ ((uint32_t)bin << 16) ^ (uint32_t)(attempt + 1)) % MINHASH_BINS;
+}
+
+static inline uint32_t hashWindow(const int* ids, int width, uint32_t seed) {
+    uint32_t h = seed;
+    for (int j = 0; j < width; j++) {
+        h = (h ^ (uint32_t)ids[j]) * FNV_PRIME;
+    }
+    return fmix32(h);
+}
+
+MinHasher* createMinHasher(int ngram, int bands, uint32_t seed) {
+    if (ngram < 1 || bands < 1 || MINHASH_BINS % bands != 0) return NULL;
+    MinHasher* hasher = (MinHasher*)calloc(1, sizeof(MinHasher));
+    if (!hasher) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    hasher->ngram = ngram;
+    hasher->bands = bands;
+    hasher->seed = seed;
+    for (int i = 0; i < MINHASH_BINS; i++) {
+        for (int attempt = 0; attempt < MINHASH_PROBES; attempt++) {
+            hasher->probes[i][attempt] = (unsigned char)probeBin(seed, i, attempt);
+        }
+    }
+    return hasher;
+}
+
+static inline void addShingle(uint32_t* signature, uint32_t hash) {
+    uint32_t* bin = &signature[hash >> BIN_SHIFT];
+    if (hash < *bin) *bin = hash;
+}
+
+// Empty bin i takes the value of the first non-empty bin on its own
+// pseudo-random probe sequence, so two documents fill the same empty bin
+// from the same place.
+static void densify(const MinHasher* hasher, uint32_t* signature) {
+    int num_filled = 0;
+    for (int i = 0; i < MINHASH_BINS; i++) {
+        if (signature[i] != EMPTY_BIN) num_filled++;
+    }
+    if (num_filled == 0 || num_filled == MINHASH_BINS) return;
+    uint32_t filled[MINHASH_BINS];
+    memcpy(filled, signature, sizeof(filled));
+    for (int i = 0; i < MINHASH_BINS; i++) {
+        if (filled[i] != EMPTY_BIN) continue;
+        for (int attempt = 0;; attempt++) {
+            uint32_t probe = attempt < MINHASH_PROBES ? hasher->probes[i][attempt] : probeBin(hasher->seed, i, attempt);
+            if (filled[probe] != EMPTY_BIN) {
+                signature[i] = filled[probe];
+                break;
+            }
+        }
+    }
+}
+
+void minhashIds(const MinHasher* hasher, const int* ids, int num_ids, uint32_t* signature) {
+    memset(signature, 0xFF, MINHASH_BINS * sizeof(uint32_t));
+    if (num_ids == 0) return;
+    int width = num_ids < hasher->ngram ? num_ids : hasher->ngram;
+    int num_shingles = num_ids - width + 1;
+    int i = 0;
+#ifdef __AVX2__
+    // Eight overlapping windows per step: lane k hashes ids[i + k ..].
+    const __m256i prime = _mm256_set1_epi32((int)FNV_PRIME);
+    const __m256i seed = _mm256_set1_epi32((int)hasher->seed);
+    for (; i + 8 <= num_shingles; i += 8) {
+        __m256i h = seed;
+        for (int j = 0; j < width; j++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(ids + i + j));
+            h = _mm256_mullo_epi32(_mm256_xor_si256(h, v), prime);
+        }
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+        h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x85EBCA6Bu));
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+        h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0xC2B2AE35u));
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+        uint32_t hashes[8];
+        _mm256_storeu_si256((__m256i*)hashes, h);
+        for (int k = 0; k < 8; k++) addShingle(signature, hashes[k]);
+    }
+#endif
+    for (; i < num_shingles; i++) {
+        addShingle(signature, hashWindow(ids + i, width, hasher->seed));
+    }
+    densify(hasher, signature);
+}
+
+void minhashBands(const MinHasher* hasher, const uint32_t* signature, uint64_t* band_hashes) {
+    int rows = MINHASH_BINS / hasher->bands;
+    for (int band = 0; band < hasher->bands; band++) {
+        // The band index is mixed in so equal rows in different bands differ.
+        uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t)band;
+        for (int r = 0; r < rows; r++) {
+            hash = (hash ^ signature[band * rows + r]) * 0x100000001B3ULL;
+            hash ^= hash >> 29;
+        }
+        band_hashes[band] = hash;
+    }
+}
+
+void freeMinHasher(MinHasher* hasher) {
+    free(hasher);
+}
@@ -0,0 +1,43 @@
+#ifndef RWKV_MINHASH_H
+#define RWKV_MINHASH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MINHASH_BINS 128
+#define MINHASH_PROBES 32
+
+// One-permutation MinHash with optimal densification (Shrivastava, 2017)
+// over token n-grams. Each n-gram of ids is hashed once to 32 bits; the top
+// 7 bits pick one of MINHASH_BINS bins and the bin keeps the minimum hash,
+// which estimates Jaccard similarity like 128 independent permutations at
+// the cost of one. Bins left empty by short documents borrow the value of
+// a pseudo-randomly chosen non-empty bin. Signatures are split into `bands`
+// LSH bands of MINHASH_BINS / bands rows, each hashed to 64 bits, so
+// near-duplicates share at least one band hash with high probability.
+typedef struct {
+    int ngram;
+    int bands;
+    uint32_t seed;
+    // Densification probe sequences, shared by every document. Short
+    // documents leave most bins empty, so these are precomputed.
+    unsigned char probes[MINHASH_BINS][MINHASH_PROBES];
+} MinHasher;
+
+// Returns NULL if bands does not divide MINHASH_BINS or ngram < 1. The same
+// seed gives the same hashes, so signatures from separate runs compare.
+MinHasher* createMinHasher(int ngram, int bands, uint32_t seed);
+// Writes MINHASH_BINS values. A document shorter than one n-gram is hashed
+// as a single shingle; an empty one gets all 0xFFFFFFFF.
+void minhashIds(const MinHasher* hasher, const int* ids, int num_ids, uint32_t* signature);
+void minhashBands(const MinHasher* hasher, const uint32_t* signature, uint64_t* band_hashes);
+void freeMinHasher(MinHasher* hasher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
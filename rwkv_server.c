@@ -0,0 +1,458 @@
+// Tokenizer server over TCP with a length-prefixed binary protocol:
+//
+//   request:  uint32 byte length, [uint32 deadline in ms], then the UTF-8 text
+//   response: uint32 id count, then that many uint32 ids
+//
+// All integers are little-endian. The deadline word is present when the top
+// bit of the length is set and counts from when the request has been read;
+// requests without one get the -d default (0 = none). A request that cannot
+// finish in time is answered with a count of REJECTED and no ids. A
+// connection may send any number of requests. Concurrent requests with
+// identical text are collapsed onto one encode (see rwkv_singleflight.h).
+//
+//   ./rwkv_server [-v vocab] [-p port] [-w workers] [-t encoders] [-d deadline_ms] [-m metrics_port]
+//
+// With -w N the vocabulary is loaded once and N worker processes are forked,
+// each with its own SO_REUSEPORT listener on the same port; -t is then the
+// number of encoders per worker (default: cores / N).
+//
+// -m serves Prometheus metrics at http://127.0.0.1:<metrics_port>/metrics
+// (worker i of -w N uses metrics_port + i).
+//
+// SIGUSR1 prints the counters; SIGINT/SIGTERM print them and exit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "rwkv_tokenizer.h"
+#include "rwkv_singleflight.h"
+#include "rwkv_admission.h"
+#include "rwkv_metrics.h"
+#include "rwkv_wire.h"
+
+#define DEFAULT_PORT 8765
+#define MAX_REQUEST_BYTES (64 << 20)
+#define HAS_DEADLINE 0x80000000u
+#define REJECTED 0xFFFFFFFFu
+#define MAX_SCRAPE_REQUEST 4096
+
+typedef struct {
+    Tokenizer* tokenizer;
+    SingleFlight* flights;
+    Admission* admission;
+    int default_deadline_ms;
+    int worker;  // index among forked workers, -1 when running alone
+    Metrics* metrics;
+    int metrics_port;
+    atomic_llong connections;
+    atomic_int open_connections;
+    double start;
+} Server;
+
+typedef struct {
+    Server* server;
+    int fd;
+} Connection;
+
+static bool readFull(int fd, void* buffer, size_t length) {
+    char* ptr = (char*)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, ptr, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buffer, size_t length) {
+    const char* ptr = (const char*)buffer;
+    while (length > 0) {
+        ssize_t n = write(fd, ptr, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+}
+
+typedef struct {
+    Admission* admission;
+    long long bytes;
+    double deadline;
+    double start;  // when the slot was granted
+} EncodeGate;
+
+static bool admitLeader(void* context) {
+    EncodeGate* gate = (EncodeGate*)context;
+    if (admissionAcquire(gate->admission, gate->bytes, gate->deadline) != ADMIT_OK) return false;
+    gate->start = admissionNow();
+    return true;
+}
+
+static void* serveConnection(void* arg) {
+    Connection* connection = (Connection*)arg;
+    Server* server = connection->server;
+    int fd = connection->fd;
+    free(connection);
+    MetricsShard* metrics = metricsAcquireShard(server->metrics);
+    atomic_fetch_add_explicit(&server->open_connections, 1, memory_order_relaxed);
+
+    char* text = NULL;
+    uint32_t capacity = 0;
+    for (;;) {
+        uint32_t length;
+        if (!readFull(fd, &length, sizeof(length))) break;
+        uint32_t deadline_ms = (uint32_t)server->default_deadline_ms;
+        if (length & HAS_DEADLINE) {
+            length &= ~HAS_DEADLINE;
+            if (!readFull(fd, &deadline_ms, sizeof(deadline_ms))) break;
+        }
+        if (length > MAX_REQUEST_BYTES) {
+            fprintf(stderr, "Request of %u bytes exceeds the %d byte limit\n", length, MAX_REQUEST_BYTES);
+            break;
+        }
+        if (length > capacity) {
+            char* grown = (char*)realloc(text, length);
+            if (!grown) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            text = grown;
+            capacity = length;
+        }
+        if (!readFull(fd, text, length)) break;
+        double received = admissionNow();
+        metricsAdd(metrics, METRIC_REQUESTS, 1);
+
+        // Only the request that leads a flight takes an encoder slot; ones
+        // that collapse onto it wait without holding a slot or queued bytes.
+        EncodeGate gate = {server->admission, length, deadline_ms > 0 ? received + deadline_ms * 1e-3 : 0, 0};
+        bool collapsed;
+        FlightResult* result = singleFlightEncode(server->flights, server->tokenizer, text, (int)length,
+                                                  gate.deadline, admitLeader, &gate, &collapsed);
+        if (collapsed) admissionFollowed(server->admission, gate.deadline, !result);
+        if (!result) {
+            metricsAdd(metrics, METRIC_REJECTED, 1);
+            uint32_t rejected = REJECTED;
+            if (!writeFull(fd, &rejected, sizeof(rejected))) break;
+            continue;
+        }
+        if (!collapsed) admissionRelease(server->admission, length, gate.deadline, admissionNow() - gate.start);
+        uint32_t count = (uint32_t)result->num_ids;
+        bool ok = writeFull(fd, &count, sizeof(count)) &&
+                  writeFull(fd, idsToWire(result->ids), count * sizeof(uint32_t));
+        releaseFlightResult(result);
+        metricsAdd(metrics, METRIC_ENCODED_BYTES, length);
+        metricsAdd(metrics, METRIC_ENCODED_TOKENS, count);
+        if (collapsed) metricsAdd(metrics, METRIC_COLLAPSED, 1);
+        metricsObserveLatency(metrics, admissionNow() - received);
+        if (!ok) break;
+    }
+    atomic_fetch_sub_explicit(&server->open_connections, 1, memory_order_relaxed);
+    metricsReleaseShard(server->metrics, metrics);
+    free(text);
+    close(fd);
+    return NULL;
+}
+
+static void printCounters(Server* server) {
+    MetricsSnapshot snapshot;
+    metricsSnapshot(server->metrics, &snapshot);
+    double elapsed = admissionNow() - server->start;
+    long long requests = snapshot.counters[METRIC_REQUESTS];
+    long long collapsed = atomic_load(&server->flights->collapsed);
+    Admission* admission = server->admission;
+    char prefix[32] = "";
+    if (server->worker >= 0) snprintf(prefix, sizeof(prefix), "worker=%d ", server->worker);
+    fprintf(stderr, "summary %sconnections=%lld requests=%lld bytes=%lld tokens=%lld encodes=%lld collapsed=%lld "
+            "collapsed_bytes=%lld collapsed_ratio=%.3f in_flight=%lld admitted=%lld shed=%lld expired=%lld late=%lld "
+            "queue_depth=%d rate_mbps=%.1f p50_ms=%.3f p99_ms=%.3f seconds=%.1f\n", prefix,
+            (long long)atomic_load(&server->connections), requests, snapshot.counters[METRIC_ENCODED_BYTES],
+            snapshot.counters[METRIC_ENCODED_TOKENS], (long long)atomic_load(&server->flights->leaders), collapsed,
+            (long long)atomic_load(&server->flights->collapsed_bytes), requests > 0 ? (double)collapsed / requests : 0,
+            (long long)atomic_load(&server->flights->in_flight), (long long)atomic_load(&admission->admitted),
+            (long long)atomic_load(&admission->shed), (long long)atomic_load(&admission->expired),
+            (long long)atomic_load(&admission->late), atomic_load(&admission->queue_depth),
+            admissionRate(admission) / 1e6, metricsLatencyQuantile(&snapshot, 0.5) * 1e3,
+            metricsLatencyQuantile(&snapshot, 0.99) * 1e3, elapsed);
+}
+
+// Counters come from the per-thread shards; gauges are read directly.
+static void writeMetricsPage(Server* server, FILE* out) {
+    MetricsSnapshot snapshot;
+    metricsSnapshot(server->metrics, &snapshot);
+    metricsWritePrometheus(&snapshot, out);
+    SingleFlight* flights = server->flights;
+    Admission* admission = server->admission;
+    fprintf(out, "# HELP rwkv_encodes_total Encodes performed (requests minus collapsed and rejected ones).\n"
+                 "# TYPE rwkv_encodes_total counter\nrwkv_encodes_total %lld\n",
+            (long long)atomic_load(&flights->leaders));
+    fprintf(out, "# HELP rwkv_connections_total Connections accepted.\n"
+                 "# TYPE rwkv_connections_total counter\nrwkv_connections_total %lld\n",
+            (long long)atomic_load(&server->connections));
+    fprintf(out, "# HELP rwkv_open_connections Connections currently open.\n"
+                 "# TYPE rwkv_open_connections gauge\nrwkv_open_connections %d\n",
+            atomic_load(&server->open_connections));
+    fprintf(out, "# HELP rwkv_queue_depth Requests waiting for an encoder slot.\n"
+                 "# TYPE rwkv_queue_depth gauge\nrwkv_queue_depth %d\n",
+            atomic_load(&admission->queue_depth));
+    fprintf(out, "# HELP rwkv_encodes_in_flight Encodes currently running.\n"
+                 "# TYPE rwkv_encodes_in_flight gauge\nrwkv_encodes_in_flight %lld\n",
+            (long long)atomic_load(&flights->in_flight));
+    fprintf(out, "# HELP rwkv_encode_rate_bytes_per_second Estimated encode throughput of one slot.\n"
+                 "# TYPE rwkv_encode_rate_bytes_per_second gauge\nrwkv_encode_rate_bytes_per_second %.0f\n",
+            admissionRate(admission));
+}
+
+// Minimal HTTP/1.0 responder for GET /metrics on the loopback interface.
+static void* metricsThread(void* arg) {
+    Server* server = (Server*)arg;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)server->metrics_port);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "Failed to listen for metrics on port %d: %s\n", server->metrics_port, strerror(errno));
+        return NULL;
+    }
+    char request[MAX_SCRAPE_REQUEST + 1];
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        struct timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int length = 0;
+        while (length < MAX_SCRAPE_REQUEST) {
+            ssize_t n = read(fd, request + length, MAX_SCRAPE_REQUEST - length);
+            if (n <= 0) break;
+            length += n;
+            request[length] = '\0';
+            if (strstr(request, "\r\n\r\n")) break;
+        }
+        request[length] = '\0';
+
+        char* body = NULL;
+        size_t body_length = 0;
+        FILE* out = open_memstream(&body, &body_length);
+        const char* status = "200 OK";
+        if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+            writeMetricsPage(server, out);
+        } else {
+            status = "404 Not Found";
+            fprintf(out, "not found\n");
+        }
+        fclose(out);
+        char header[160];
+        int header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                     status, body_length);
+        if (writeFull(fd, header, header_length)) writeFull(fd, body, body_length);
+        free(body);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void* signalThread(void* arg) {
+    Server* server = (Server*)arg;
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    for (;;) {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0) continue;
+        printCounters(server);
+        if (signal_number != SIGUSR1) exit(0);
+    }
+    return NULL;
+}
+
+// Runs one accept loop. With `reuse_port` several processes bind the same
+// port and the kernel spreads incoming connections across them.
+static int serve(Tokenizer* tokenizer, int port, bool reuse_port, int encoders, int default_deadline_ms,
+                 int metrics_port, int worker) {
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.tokenizer = tokenizer;
+    server.flights = createSingleFlight();
+    server.admission = createAdmission(encoders, measureEncodeRate(tokenizer, NULL, 0));
+    server.default_deadline_ms = default_deadline_ms;
+    server.worker = worker;
+    server.metrics = createMetrics();
+    server.metrics_port = metrics_port;
+    server.start = admissionNow();
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuse_port) setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)port);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1024) != 0) {
+        fprintf(stderr, "Failed to listen on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    if (worker < 0) {
+        fprintf(stderr, "Listening on port %d with %d tokens\n", port, tokenizer->num_tokens);
+    } else {
+        fprintf(stderr, "Worker %d (pid %d) listening on port %d with %d encoders\n", worker, (int)getpid(), port, encoders);
+    }
+
+    pthread_t signal_thread;
+    pthread_create(&signal_thread, NULL, signalThread, &server);
+    pthread_detach(signal_thread);
+    if (metrics_port > 0) {
+        pthread_t metrics_thread;
+        pthread_create(&metrics_thread, NULL, metricsThread, &server);
+        pthread_detach(metrics_thread);
+    }
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection* connection = (Connection*)malloc(sizeof(Connection));
+        if (!connection) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        connection->server = &server;
+        connection->fd = fd;
+        atomic_fetch_add_explicit(&server.connections, 1, memory_order_relaxed);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveConnection, connection) != 0) {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listener);
+    freeMetrics(server.metrics);
+    freeAdmission(server.admission);
+    freeSingleFlight(server.flights);
+    freeTokenizer(server.tokenizer);
+    return 1;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-v vocab] [-p port] [-w workers] [-t encoders] [-d deadline_ms] [-m metrics_port]\n", program);
+}
+
+int main(int argc, char** argv) {
+    const char* vocab = "rwkv_vocab_v20230424.txt";
+    int port = DEFAULT_PORT;
+    int encoders = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int encoders_per_worker = 0;
+    int workers = 1;
+    int default_deadline_ms = 0;
+    int metrics_port = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            vocab = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            encoders = encoders_per_worker = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            default_deadline_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            metrics_port = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Signals are handled by one thread with sigwait(), so block them
+    // before any other thread starts.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Tokenizer* tokenizer = createTokenizer();
+    if (loadVocab(tokenizer, vocab) != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
+    if (workers <= 1) {
+        return serve(tokenizer, port, false, encoders, default_deadline_ms, metrics_port, -1);
+    }
+
+    // The tokenizer is only read after loading, so its pages stay shared
+    // copy-on-write between the forked workers. Fork before any thread exists.
+    if (!encoders_per_worker) encoders = encoders / workers > 0 ? encoders / workers : 1;
+    pid_t* children = (pid_t*)malloc(workers * sizeof(pid_t));
+    if (!children) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    // Blocked before forking so an early worker exit is not lost.
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    for (int w = 0; w < workers; w++) {
+        children[w] = fork();
+        if (children[w] == 0) {
+            return serve(tokenizer, port, true, encoders, default_deadline_ms, metrics_port > 0 ? metrics_port + w : 0, w);
+        }
+        if (children[w] < 0) {
+            fprintf(stderr, "fork failed: %s\n", strerror(errno));
+            workers = w;
+            break;
+        }
+    }
+    // The parent only relays signals and reaps workers; each worker prints
+    // its own counters.
+    int exit_code = 0;
+    int running = workers;
+    while (running > 0) {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0) continue;
+        if (signal_number != SIGCHLD) {
+            for (int w = 0; w < workers; w++) kill(children[w], signal_number);
+            continue;
+        }
+        int status;
+        while (waitpid(-1, &status, WNOHANG) > 0) {
+            running--;
+            if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0)) exit_code = 1;
+        }
+    }
+    free(children);
+    freeTokenizer(tokenizer);
+    return exit_code;
+}
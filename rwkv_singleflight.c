@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "rwkv_singleflight.h"
+
+SingleFlight* createSingleFlight(void) {
+    SingleFlight* flights = (SingleFlight*)calloc(1, sizeof(SingleFlight));
+    if (!flights) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < SINGLE_FLIGHT_SHARDS; i++) {
+        pthread_mutex_init(&flights->shards[i].lock, NULL);
+    }
+    return flights;
+}
+
+// 64-bit FNV-1a, 8 bytes per round where possible.
+static uint64_t hashBytes(const char* data, int length) {
+    uint64_t hash = 14695981039346656037ULL;
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return hash ^ (uint64_t)length;
+}
+
+// Unlinks a flight the leader is finished with and wakes its followers.
+// `data` belongs to the leader's caller, so the flight must not stay listed;
+// followers already waiting keep it alive and the last one frees it.
+static void finishFlight(FlightShard* shard, Flight* flight, FlightResult* result) {
+    pthread_mutex_lock(&shard->lock);
+    Flight** link = &shard->head;
+    while (*link != flight) link = &(*link)->next;
+    *link = flight->next;
+    flight->data = NULL;
+    if (result) {
+        atomic_init(&result->refs, 1 + flight->waiters);
+    } else {
+        flight->abandoned = true;
+    }
+    flight->result = result;
+    flight->done = true;
+    bool waited = flight->waiters > 0;
+    if (waited) pthread_cond_broadcast(&flight->cond);
+    pthread_mutex_unlock(&shard->lock);
+    if (!waited) {
+        pthread_cond_destroy(&flight->cond);
+        free(flight);
+    }
+}
+
+FlightResult* singleFlightEncode(SingleFlight* flights, Tokenizer* tokenizer, const char* data, int length,
+                                 double deadline, FlightGate gate, void* gate_context, bool* collapsed) {
+    uint64_t hash = hashBytes(data, length);
+    FlightShard* shard = &flights->shards[hash % SINGLE_FLIGHT_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+retry:
+    for (Flight* flight = shard->head; flight; flight = flight->next) {
+        if (flight->hash == hash && flight->length == length && memcmp(flight->data, data, length) == 0) {
+            flight->waiters++;
+            struct timespec ts = {(time_t)deadline, (long)((deadline - (time_t)deadline) * 1e9)};
+            while (!flight->done) {
+                if (deadline <= 0) {
+                    pthread_cond_wait(&flight->cond, &shard->lock);
+                } else if (pthread_cond_timedwait(&flight->cond, &shard->lock, &ts) == ETIMEDOUT && !flight->done) {
+                    // The leader has not counted us yet, so leaving is just
+                    // not being there when it finishes.
+                    flight->waiters--;
+                    pthread_mutex_unlock(&shard->lock);
+                    if (collapsed) *collapsed = true;
+                    return NULL;
+                }
+            }
+            FlightResult* result = flight->result;  // the leader counted us in its refs
+            bool abandoned = flight->abandoned;
+            bool last = --flight->waiters == 0;
+            if (last) {
+                pthread_cond_destroy(&flight->cond);
+                free(flight);
+            }
+            // The flight is already unlinked, so this either joins a newer
+            // flight or leads one.
+            if (abandoned) goto retry;
+            pthread_mutex_unlock(&shard->lock);
+            atomic_fetch_add_explicit(&flights->collapsed, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&flights->collapsed_bytes, length, memory_order_relaxed);
+            if (collapsed) *collapsed = true;
+            return result;
+        }
+    }
+    Flight* flight = (Flight*)calloc(1, sizeof(Flight));
+    FlightResult* result = (FlightResult*)calloc(1, sizeof(FlightResult));
+    if (!flight || !result) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    flight->hash = hash;
+    flight->data = data;
+    flight->length = length;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flight->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    flight->next = shard->head;
+    shard->head = flight;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (gate && !gate(gate_context)) {
+        free(result);
+        finishFlight(shard, flight, NULL);
+        if (collapsed) *collapsed = false;
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&flights->in_flight, 1, memory_order_relaxed);
+    result->ids = encodeBytes(tokenizer, data, length, &result->num_ids);
+    atomic_fetch_sub_explicit(&flights->in_flight, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&flights->leaders, 1, memory_order_relaxed);
+
+    finishFlight(shard, flight, result);
+    if (collapsed) *collapsed = false;
+    return result;
+}
+
+void releaseFlightResult(FlightResult* result) {
+    if (result && atomic_fetch_sub_explicit(&result->refs, 1, memory_order_acq_rel) == 1) {
+        free(result->ids);
+        free(result);
+    }
+}
+
+void freeSingleFlight(SingleFlight* flights) {
+    if (!flights) return;
+    for (int i = 0; i < SINGLE_FLIGHT_SHARDS; i++) {
+        pthread_mutex_destroy(&flights->shards[i].lock);
+    }
+    free(flights);
+}
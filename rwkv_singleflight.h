@@ -0,0 +1,71 @@
+#ifndef RWKV_SINGLEFLIGHT_H
+#define RWKV_SINGLEFLIGHT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rwkv_tokenizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SINGLE_FLIGHT_SHARDS 64
+
+// Ids shared by a leader and every follower that collapsed onto it.
+typedef struct {
+    atomic_int refs;
+    int* ids;
+    int num_ids;
+} FlightResult;
+
+typedef struct Flight {
+    uint64_t hash;
+    const char* data;  // the leader's input, valid while the flight is listed
+    int length;
+    bool done;
+    bool abandoned;  // the leader's gate refused; followers retry on their own
+    int waiters;
+    FlightResult* result;
+    pthread_cond_t cond;
+    struct Flight* next;
+} Flight;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Flight* head;
+} FlightShard;
+
+// Collapses concurrent encodes of identical input: the first caller (the
+// leader) encodes, callers that arrive with the same bytes while it runs
+// (followers) wait for and share its result. Inputs are matched by hash and
+// then compared byte for byte.
+typedef struct {
+    FlightShard shards[SINGLE_FLIGHT_SHARDS];
+    atomic_llong leaders;          // encodes performed
+    atomic_llong collapsed;        // requests answered by another request's encode
+    atomic_llong collapsed_bytes;  // input bytes those requests did not encode
+    atomic_llong in_flight;
+} SingleFlight;
+
+// Called by a leader, outside any lock, after followers can already join it
+// and before it encodes; e.g. to wait for an encoder slot. Returning false
+// abandons the flight: the leader gets NULL and its followers start over.
+typedef bool (*FlightGate)(void* context);
+
+SingleFlight* createSingleFlight(void);
+// Returns the ids for `data`; release them with releaseFlightResult().
+// *collapsed (if not NULL) reports whether this caller followed another
+// request. Returns NULL when this caller led and `gate` (if not NULL)
+// refused, or followed and `deadline` (CLOCK_MONOTONIC seconds, 0 for none)
+// passed before the leader finished.
+FlightResult* singleFlightEncode(SingleFlight* flights, Tokenizer* tokenizer, const char* data, int length,
+                                 double deadline, FlightGate gate, void* gate_context, bool* collapsed);
+void releaseFlightResult(FlightResult* result);
+void freeSingleFlight(SingleFlight* flights);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
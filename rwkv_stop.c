@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rwkv_stop.h"
+
+StopMatcher* createStopMatcher(const char* const* stops, const int* lengths, int num_stops) {
+    int max_states = 1;
+    for (int i = 0; i < num_stops; i++) {
+        if (lengths[i] <= 0) {
+            fprintf(stderr, "Empty stop string\n");
+            return NULL;
+        }
+        max_states += lengths[i];
+    }
+
+    StopMatcher* matcher = (StopMatcher*)calloc(1, sizeof(StopMatcher));
+    int (*next)[256] = (int (*)[256])malloc(max_states * sizeof(*next));
+    int* match = (int*)malloc(max_states * sizeof(int));
+    int* match_length = (int*)calloc(max_states, sizeof(int));
+    int* fail = (int*)calloc(max_states, sizeof(int));
+    int* queue = (int*)malloc(max_states * sizeof(int));
+    if (!matcher || !next || !match || !match_length || !fail || !queue) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    memset(next, 0xff, max_states * sizeof(*next));
+    for (int i = 0; i < max_states; i++) {
+        match[i] = -1;
+    }
+
+    // Trie of the stop strings; -1 marks a missing edge until the BFS below
+    // turns the trie into a full DFA.
+    int num_states = 1;
+    for (int i = 0; i < num_stops; i++) {
+        const unsigned char* stop = (const unsigned char*)stops[i];
+        int state = 0;
+        for (int j = 0; j < lengths[i]; j++) {
+            if (next[state][stop[j]] < 0) {
+                next[state][stop[j]] = num_states++;
+            }
+            state = next[state][stop[j]];
+        }
+        if (match[state] < 0) {
+            match[state] = i;
+            match_length[state] = lengths[i];
+        }
+    }
+
+    int head = 0, tail = 0;
+    for (int c = 0; c < 256; c++) {
+        if (next[0][c] < 0) {
+            next[0][c] = 0;
+        } else {
+            fail[next[0][c]] = 0;
+            queue[tail++] = next[0][c];
+        }
+    }
+    while (head < tail) {
+        int state = queue[head++];
+        // A stop string ending at the failure state also ends here. Keep the
+        // longest one, since it starts earliest in the output.
+        if (match_length[fail[state]] > match_length[state]) {
+            match[state] = match[fail[state]];
+            match_length[state] = match_length[fail[state]];
+        }
+        for (int c = 0; c < 256; c++) {
+            int child = next[state][c];
+            if (child < 0) {
+                next[state][c] = next[fail[state]][c];
+            } else {
+                fail[child] = next[fail[state]][c];
+                queue[tail++] = child;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    matcher->num_states = num_states;
+    matcher->next = next;
+    matcher->match = match;
+    matcher->match_length = match_length;
+    stopMatcherReset(matcher);
+    return matcher;
+}
+
+void stopMatcherReset(StopMatcher* matcher) {
+    matcher->state = 0;
+    matcher->consumed = 0;
+    matcher->num_hits = 0;
+}
+
+static void addHit(StopMatcher* matcher, int stop, int64_t cut) {
+    if (matcher->num_hits == matcher->hit_capacity) {
+        matcher->hit_capacity = matcher->hit_capacity ? matcher->hit_capacity * 2 : 4;
+        matcher->hits = (StopHit*)realloc(matcher->hits, matcher->hit_capacity * sizeof(StopHit));
+        if (!matcher->hits) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    matcher->hits[matcher->num_hits].stop = stop;
+    matcher->hits[matcher->num_hits].cut = cut;
+    matcher->num_hits++;
+}
+
+int stopMatcherFeed(StopMatcher* matcher, const unsigned char* data, int length, int64_t* cut) {
+    int state = matcher->state;
+    matcher->num_hits = 0;
+    for (int i = 0; i < length; i++) {
+        state = matcher->next[state][data[i]];
+        if (matcher->match[state] >= 0) {
+            int64_t end = matcher->consumed + i + 1;
+            addHit(matcher, matcher->match[state], end - matcher->match_length[state]);
+            state = 0;
+        }
+    }
+    matcher->state = state;
+    matcher->consumed += length;
+    if (matcher->num_hits == 0) return -1;
+    *cut = matcher->hits[0].cut;
+    return matcher->hits[0].stop;
+}
+
+int stopMatcherFeedToken(StopMatcher* matcher, const Tokenizer* tokenizer, int id, int64_t* cut) {
+    int length;
+    const unsigned char* bytes = tokenBytes(tokenizer, id, &length);
+    if (!bytes) {
+        fprintf(stderr, "Unknown token ID: %d\n", id);
+        return -1;
+    }
+    return stopMatcherFeed(matcher, bytes, length, cut);
+}
+
+void freeStopMatcher(StopMatcher* matcher) {
+    if (!matcher) return;
+    free(matcher->next);
+    free(matcher->match);
+    free(matcher->match_length);
+    free(matcher->hits);
+    free(matcher);
+}
+
+#ifdef RWKV_STOP_TEST
+// gcc -DRWKV_STOP_TEST -DRWKV_TOKENIZER_NO_MAIN rwkv_stop.c rwkv_tokenizer.c -o rwkv_stop_test -pthread
+static int failures = 0;
+
+static void expect(int ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    const char* stops[] = {"ab", "cd"};
+    int lengths[] = {2, 2};
+    StopMatcher* matcher = createStopMatcher(stops, lengths, 2);
+    int64_t cut = -1;
+
+    // Two stops inside one chunk: both are reported and the chunk is consumed.
+    int stop = stopMatcherFeed(matcher, (const unsigned char*)"xabcdyy", 7, &cut);
+    expect(stop == 0 && cut == 1, "first stop in chunk");
+    expect(matcher->num_hits == 2, "both stops in chunk");
+    expect(matcher->num_hits == 2 && matcher->hits[1].stop == 1 && matcher->hits[1].cut == 3, "second stop in chunk");
+    expect(matcher->consumed == 7, "whole chunk consumed");
+
+    // Offsets keep counting across feeds, including a stop split between them.
+    expect(stopMatcherFeed(matcher, (const unsigned char*)"a", 1, &cut) == -1, "partial stop");
+    stop = stopMatcherFeed(matcher, (const unsigned char*)"b", 1, &cut);
+    expect(stop == 0 && cut == 7, "stop spanning feeds");
+
+    stopMatcherReset(matcher);
+    stop = stopMatcherFeed(matcher, (const unsigned char*)"cd", 2, &cut);
+    expect(stop == 1 && cut == 0, "offsets restart after reset");
+    freeStopMatcher(matcher);
+
+    if (failures == 0) printf("rwkv_stop: all tests passed\n");
+    return failures == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef RWKV_STOP_H
+#define RWKV_STOP_H
+
+#include <stdint.h>
+#include "rwkv_tokenizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Aho-Corasick automaton over a set of stop strings, compiled into a dense
+// byte transition table. Feed it decoded output as it is produced (per
+// token via stopMatcherFeedToken) and it reports every stop string that
+// completes, even when the string spans several tokens.
+typedef struct {
+    int stop;     // index of the stop string
+    int64_t cut;  // offset from the last reset where it starts
+} StopHit;
+
+typedef struct {
+    int num_states;
+    int (*next)[256];
+    int* match;        // stop index completing at this state, or -1
+    int* match_length; // its length in bytes
+    int state;
+    int64_t consumed;  // bytes fed since the last reset
+    StopHit* hits;     // hits from the last feed, in output order
+    int num_hits;
+    int hit_capacity;
+} StopMatcher;
+
+StopMatcher* createStopMatcher(const char* const* stops, const int* lengths, int num_stops);
+void stopMatcherReset(StopMatcher* matcher);
+// Returns the index of the first stop string that completed, or -1. On a
+// match, *cut is the offset (counted from the last reset) where that stop
+// string starts, i.e. the length of output to keep. The whole chunk is
+// always consumed: matching restarts after each hit, so later stops in the
+// same chunk are found too, and all of them are in matcher->hits.
+int stopMatcherFeed(StopMatcher* matcher, const unsigned char* data, int length, int64_t* cut);
+int stopMatcherFeedToken(StopMatcher* matcher, const Tokenizer* tokenizer, int id, int64_t* cut);
+void freeStopMatcher(StopMatcher* matcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rwkv_template.h"
+
+static void* xcalloc(size_t count, size_t size) {
+    void* ptr = calloc(count > 0 ? count : 1, size);
+    if (!ptr) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// `last` segments are followed by nothing, so all of their ids are final.
+static void compileSegment(const Tokenizer* tokenizer, TemplateSegment* segment,
+                           const char* text, int length, bool last) {
+    segment->text = (char*)xcalloc(length + 1, 1);
+    memcpy(segment->text, text, length);
+    segment->length = length;
+    segment->ids = (int*)xcalloc(length, sizeof(int));
+    segment->starts = (int*)xcalloc(length + 1, sizeof(int));
+    int offset = 0;
+    while (offset < length) {
+        segment->starts[segment->num_ids] = offset;
+        offset += nextToken(tokenizer, text + offset, length - offset, &segment->ids[segment->num_ids]);
+        segment->num_ids++;
+    }
+    segment->starts[segment->num_ids] = length;
+
+    segment->num_safe = segment->num_ids;
+    if (!last) {
+        for (int i = 0; i < segment->num_ids; i++) {
+            int start = segment->starts[i];
+            if (matchLookahead(tokenizer, text + start, length - start) == length - start) {
+                segment->num_safe = i;
+                break;
+            }
+        }
+    }
+
+    // Matching that enters the segment mid-token lands on some offset q.
+    // From there greedy steps within the segment until they hit one of the
+    // pre-encoded token starts; sync[q] records which, so encoding can
+    // switch back to the stored ids after a few tokens.
+    int safe_end = segment->starts[segment->num_safe];
+    int* boundary = (int*)xcalloc(length + 1, sizeof(int));
+    memset(boundary, 0xff, (length + 1) * sizeof(int));
+    for (int i = 0; i <= segment->num_safe; i++) {
+        boundary[segment->starts[i]] = i;
+    }
+    segment->sync = (int*)xcalloc(safe_end, sizeof(int));
+    for (int q = safe_end - 1; q >= 0; q--) {
+        if (boundary[q] >= 0) {
+            segment->sync[q] = boundary[q];
+            continue;
+        }
+        int id;
+        int next = q + nextToken(tokenizer, text + q, length - q, &id);
+        bool safe = last || matchLookahead(tokenizer, text + q, length - q) < length - q;
+        if (!safe || next > safe_end) {
+            segment->sync[q] = -1;
+        } else {
+            segment->sync[q] = next == safe_end ? segment->num_safe : segment->sync[next];
+        }
+    }
+    free(boundary);
+}
+
+ChatTemplate* compileTemplate(const Tokenizer* tokenizer, const char* text, int length) {
+    int num_slots = 0;
+    for (int i = 0; i + 1 < length; i++) {
+        if (text[i] == '{' && text[i + 1] == '{') {
+            const char* close = NULL;
+            for (int j = i + 2; j + 1 < length; j++) {
+                if (text[j] == '}' && text[j + 1] == '}') {
+                    close = text + j;
+                    break;
+                }
+            }
+            if (!close) {
+                fprintf(stderr, "Unterminated template slot at offset %d\n", i);
+                return NULL;
+            }
+            num_slots++;
+            i = (int)(close - text) + 1;
+        }
+    }
+
+    ChatTemplate* tmpl = (ChatTemplate*)xcalloc(1, sizeof(ChatTemplate));
+    tmpl->tokenizer = tokenizer;
+    tmpl->num_slots = num_slots;
+    tmpl->slot_value = (int*)xcalloc(num_slots, sizeof(int));
+    tmpl->segments = (TemplateSegment*)xcalloc(num_slots + 1, sizeof(TemplateSegment));
+    tmpl->names = (char**)xcalloc(num_slots, sizeof(char*));
+
+    int segment_start = 0;
+    int slot = 0;
+    for (int i = 0; i + 1 < length; i++) {
+        if (text[i] != '{' || text[i + 1] != '{') continue;
+        int name_start = i + 2;
+        int name_end = name_start;
+        while (text[name_end] != '}' || text[name_end + 1] != '}') name_end++;
+        compileSegment(tokenizer, &tmpl->segments[slot], text + segment_start, i - segment_start, false);
+
+        int name_length = name_end - name_start;
+        int value = -1;
+        for (int n = 0; n < tmpl->num_names; n++) {
+            if ((int)strlen(tmpl->names[n]) == name_length && memcmp(tmpl->names[n], text + name_start, name_length) == 0) {
+                value = n;
+                break;
+            }
+        }
+        if (value < 0) {
+            value = tmpl->num_names++;
+            tmpl->names[value] = (char*)xcalloc(name_length + 1, 1);
+            memcpy(tmpl->names[value], text + name_start, name_length);
+        }
+        tmpl->slot_value[slot++] = value;
+        segment_start = name_end + 2;
+        i = name_end + 1;
+    }
+    compileSegment(tokenizer, &tmpl->segments[slot], text + segment_start, length - segment_start, true);
+    return tmpl;
+}
+
+int templateSlot(const ChatTemplate* tmpl, const char* name) {
+    for (int n = 0; n < tmpl->num_names; n++) {
+        if (strcmp(tmpl->names[n], name) == 0) return n;
+    }
+    return -1;
+}
+
+int templateLength(const ChatTemplate* tmpl, const int* lengths) {
+    int total = 0;
+    for (int s = 0; s <= tmpl->num_slots; s++) {
+        total += tmpl->segments[s].length;
+        if (s < tmpl->num_slots) total += lengths[tmpl->slot_value[s]];
+    }
+    return total;
+}
+
+// The rendered text as pieces: even pieces are segments, odd ones slots.
+static inline const char* pieceData(const ChatTemplate* tmpl, const char* const* values,
+                                    const int* lengths, int piece, int* length) {
+    if (piece & 1) {
+        int value = tmpl->slot_value[piece >> 1];
+        *length = lengths[value];
+        return values[value];
+    }
+    *length = tmpl->segments[piece >> 1].length;
+    return tmpl->segments[piece >> 1].text;
+}
+
+int encodeTemplate(const ChatTemplate* tmpl, const char* const* values, const int* lengths, int* out) {
+    const Tokenizer* tokenizer = tmpl->tokenizer;
+    int last = 2 * tmpl->num_slots;
+    int length;
+    while (last > 0 && (pieceData(tmpl, values, lengths, last, &length), length == 0)) last--;
+
+    // Tokens that start within MAX_TOKEN_LENGTH of a piece's end are matched
+    // in a stitched copy of the following bytes, as in encodeFragments().
+    char window[2 * MAX_TOKEN_LENGTH];
+    long window_start = -1;
+    int window_length = 0;
+    bool window_final = false;
+
+    int num_encoded = 0;
+    long position = 0;    // in the rendered text
+    long piece_start = 0;
+    int piece = 0;
+    while (piece <= last) {
+        const char* data = pieceData(tmpl, values, lengths, piece, &length);
+        int offset = (int)(position - piece_start);
+        if (offset >= length) {
+            piece_start += length;
+            piece++;
+            continue;
+        }
+
+        if (!(piece & 1)) {
+            const TemplateSegment* segment = &tmpl->segments[piece >> 1];
+            int safe_end = segment->starts[segment->num_safe];
+            if (offset < safe_end && segment->sync[offset] >= 0) {
+                int first = segment->sync[offset];
+                while (offset < segment->starts[first]) {
+                    offset += nextToken(tokenizer, data + offset, length - offset, &out[num_encoded++]);
+                }
+                memcpy(out + num_encoded, segment->ids + first, (segment->num_safe - first) * sizeof(int));
+                num_encoded += segment->num_safe - first;
+                position = piece_start + safe_end;
+                continue;
+            }
+        }
+
+        if (offset + MAX_TOKEN_LENGTH <= length || piece == last) {
+            position += nextToken(tokenizer, data + offset, length - offset, &out[num_encoded++]);
+            continue;
+        }
+        if (position < window_start || position >= window_start + window_length ||
+            (!window_final && position + MAX_TOKEN_LENGTH > window_start + window_length)) {
+            window_start = position;
+            window_length = 0;
+            int p = piece;
+            int p_offset = offset;
+            while (p <= last && window_length < (int)sizeof(window)) {
+                int p_length;
+                const char* p_data = pieceData(tmpl, values, lengths, p, &p_length);
+                int n = p_length - p_offset;
+                if (n > (int)sizeof(window) - window_length) n = (int)sizeof(window) - window_length;
+                memcpy(window + window_length, p_data + p_offset, n);
+                window_length += n;
+                p++;
+                p_offset = 0;
+            }
+            window_final = window_length < (int)sizeof(window);
+        }
+        int in_window = (int)(position - window_start);
+        position += nextToken(tokenizer, window + in_window, window_length - in_window, &out[num_encoded++]);
+    }
+    return num_encoded;
+}
+
+void freeTemplate(ChatTemplate* tmpl) {
+    if (!tmpl) return;
+    for (int s = 0; s <= tmpl->num_slots; s++) {
+        free(tmpl->segments[s].text);
+        free(tmpl->segments[s].ids);
+        free(tmpl->segments[s].starts);
+        free(tmpl->segments[s].sync);
+    }
+    for (int n = 0; n < tmpl->num_names; n++) {
+        free(tmpl->names[n]);
+    }
+    free(tmpl->names);
+    free(tmpl->segments);
+    free(tmpl->slot_value);
+    free(tmpl);
+}
@@ -0,0 +1,52 @@
+#ifndef RWKV_TEMPLATE_H
+#define RWKV_TEMPLATE_H
+
+#include "rwkv_tokenizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A static piece of template text, encoded once at compile time.
+typedef struct {
+    char* text;
+    int length;
+    int* ids;
+    int* starts;   // byte offset of each id, plus `length` at the end
+    int num_ids;
+    int num_safe;  // ids [0, num_safe) do not depend on the text that follows
+    int* sync;     // per offset below starts[num_safe]: the id index greedy
+                   // matching from there falls into step with, or -1
+} TemplateSegment;
+
+// A chat template such as "User: {{user}}\n\nAssistant:" compiled against
+// one tokenizer. Encoding it with slot values gives the same ids as encoding
+// the rendered string, but only the slot values and the few bytes around
+// them go through the matcher; the static text comes from pre-encoded ids.
+// The tokenizer must not change while the template is in use.
+typedef struct {
+    const Tokenizer* tokenizer;
+    int num_slots;              // slot occurrences in the text
+    int* slot_value;            // value index of each occurrence
+    TemplateSegment* segments;  // num_slots + 1, around the occurrences
+    char** names;               // distinct slot names, in order of appearance
+    int num_names;
+} ChatTemplate;
+
+// Slots are written {{name}}; a name may appear more than once. Returns NULL
+// on an unterminated slot.
+ChatTemplate* compileTemplate(const Tokenizer* tokenizer, const char* text, int length);
+// Index into the values passed to encodeTemplate(), or -1.
+int templateSlot(const ChatTemplate* tmpl, const char* name);
+// Byte length of the rendered text, which bounds the number of ids.
+int templateLength(const ChatTemplate* tmpl, const int* lengths);
+// values[i] and lengths[i] fill the slot named tmpl->names[i]. Returns the
+// number of ids written to `out`.
+int encodeTemplate(const ChatTemplate* tmpl, const char* const* values, const int* lengths, int* out);
+void freeTemplate(ChatTemplate* tmpl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
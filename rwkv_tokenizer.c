@@ -3,23 +3,19 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "rwkv_tokenizer.h"
 
-#define MAX_TOKENS 100000
-#define MAX_TOKEN_LENGTH 256
-
-typedef struct TrieNode {
-    struct TrieNode* children[256];
-    int value;
-} TrieNode;
-
-typedef struct {
-    TrieNode* root;
-    unsigned char* idx2token[MAX_TOKENS];
-    int token2idx[MAX_TOKENS];
-    int num_tokens;
-} Tokenizer;
-
-TrieNode* createTrieNode() {
+TrieNode* createTrieNode(void) {
     TrieNode* node = (TrieNode*)calloc(1, sizeof(TrieNode));
     if (!node) {
         fprintf(stderr, "Memory allocation failed\n");
@@ -29,14 +25,56 @@ TrieNode* createTrieNode() {
     return node;
 }
 
+static TrieNode* addTrieChild(TrieNode* node, unsigned char c) {
+    TrieNode* child = createTrieNode();
+    if (node->dense) {
+        node->children[c] = child;
+    } else if (node->num_children < TRIE_SPARSE_CHILDREN) {
+        if (node->num_children == node->capacity) {
+            int capacity = node->capacity ? node->capacity * 2 : 1;
+            TrieNode** children = (TrieNode**)realloc(node->children, capacity * sizeof(TrieNode*));
+            if (!children) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            node->children = children;
+            node->capacity = (unsigned char)capacity;
+        }
+        node->keys[node->num_children] = c;
+        node->children[node->num_children] = child;
+    } else {
+        TrieNode** table = (TrieNode**)calloc(256, sizeof(TrieNode*));
+        if (!table) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < node->num_children; i++) {
+            table[node->keys[i]] = node->children[i];
+        }
+        free(node->children);
+        node->children = table;
+        node->dense = 1;
+        table[c] = child;
+    }
+    node->num_children++;
+    return child;
+}
+
+// Lazily built subtries hang off a dense root, so publishing one is a
+// single pointer store that concurrent readers of other bytes never see.
+typedef struct LazyTrie {
+    atomic_bool built[256];
+    pthread_mutex_t lock;
+    int* pending[256];  // ids whose first byte is the index, until built
+    int num_pending[256];
+    int pending_capacity[256];
+} LazyTrie;
+
 void insertTrie(TrieNode* root, const unsigned char* key, int key_length, int value) {
     TrieNode* node = root;
     for (int i = 0; i < key_length; i++) {
-        unsigned char c = key[i];
-        if (!node->children[c]) {
-            node->children[c] = createTrieNode();
-        }
-        node = node->children[c];
+        TrieNode* child = trieChild(node, key[i]);
+        node = child ? child : addTrieChild(node, key[i]);
     }
     node->value = value;
 }
@@ -46,8 +84,9 @@ int findLongest(TrieNode* root, const unsigned char* data, int data_length, int*
     int index = 0;
     *endIndex = 0;
     int value = -1;
-    while (index < data_length && node->children[data[index]]) {
-        node = node->children[data[index]];
+    TrieNode* child;
+    while (index < data_length && (child = trieChild(node, data[index]))) {
+        node = child;
         index++;
         if (node->value != -1) {
             *endIndex = index;
@@ -57,7 +96,135 @@ int findLongest(TrieNode* root, const unsigned char* data, int data_length, int*
     return value;
 }
 
-Tokenizer* createTokenizer() {
+static void buildSubtrie(Tokenizer* tokenizer, unsigned char c) {
+    LazyTrie* lazy = tokenizer->lazy;
+    pthread_mutex_lock(&lazy->lock);
+    if (!atomic_load_explicit(&lazy->built[c], memory_order_relaxed)) {
+        for (int i = 0; i < lazy->num_pending[c]; i++) {
+            int id = lazy->pending[c][i];
+            const unsigned char* token = tokenizer->token_data + tokenizer->token_offset[id];
+            int length = tokenizer->token_length[id];
+            if (length > 0 && token[0] == c) {  // skip ids re-added with another first byte
+                insertTrie(tokenizer->root, token, length, id);
+            }
+        }
+        free(lazy->pending[c]);
+        lazy->pending[c] = NULL;
+        lazy->num_pending[c] = 0;
+        atomic_store_explicit(&lazy->built[c], true, memory_order_release);
+    }
+    pthread_mutex_unlock(&lazy->lock);
+}
+
+static inline void ensureSubtrie(const Tokenizer* tokenizer, unsigned char c) {
+    if (tokenizer->lazy && !atomic_load_explicit(&tokenizer->lazy->built[c], memory_order_acquire)) {
+        buildSubtrie((Tokenizer*)tokenizer, c);
+    }
+}
+
+void buildCjkIndex(Tokenizer* tokenizer) {
+    for (int c = 0xE0; c <= 0xEF; c++) {
+        ensureSubtrie(tokenizer, (unsigned char)c);
+    }
+    if (!tokenizer->cjk_index) {
+        tokenizer->cjk_index = (CjkEntry*)malloc(0x10000 * sizeof(CjkEntry));
+        if (!tokenizer->cjk_index) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    for (int cp = 0; cp < 0x10000; cp++) {
+        CjkEntry* entry = &tokenizer->cjk_index[cp];
+        entry->node = NULL;
+        entry->value = -1;
+        entry->length = 0;
+        if (cp < 0x800) continue;  // never reached: would be an overlong encoding
+        unsigned char bytes[3] = {
+            (unsigned char)(0xE0 | (cp >> 12)),
+            (unsigned char)(0x80 | ((cp >> 6) & 0x3F)),
+            (unsigned char)(0x80 | (cp & 0x3F)),
+        };
+        TrieNode* node = tokenizer->root;
+        int depth = 0;
+        TrieNode* child;
+        while (depth < 3 && (child = trieChild(node, bytes[depth]))) {
+            node = child;
+            depth++;
+            if (node->value != -1) {
+                entry->value = node->value;
+                entry->length = depth;
+            }
+        }
+        if (depth == 3) entry->node = node;
+    }
+}
+
+int findLongestCJK(const Tokenizer* tokenizer, const unsigned char* data, int data_length, int* endIndex) {
+    if (data_length >= 3 && (data[0] & 0xF0) == 0xE0 && (data[1] & 0xC0) == 0x80 && (data[2] & 0xC0) == 0x80) {
+        int cp = ((data[0] & 0x0F) << 12) | ((data[1] & 0x3F) << 6) | (data[2] & 0x3F);
+        if (cp >= 0x800) {
+            const CjkEntry* entry = &tokenizer->cjk_index[cp];
+            int value = entry->value;
+            *endIndex = entry->length;
+            TrieNode* node = entry->node;
+            if (!node) return value;
+            int index = 3;
+            TrieNode* child;
+            while (index < data_length && (child = trieChild(node, data[index]))) {
+                node = child;
+                index++;
+                if (node->value != -1) {
+                    *endIndex = index;
+                    value = node->value;
+                }
+            }
+            return value;
+        }
+    }
+    return findLongest(tokenizer->root, data, data_length, endIndex);
+}
+
+static inline int matchToken(const Tokenizer* tokenizer, const unsigned char* data, int data_length, int* endIndex) {
+    ensureSubtrie(tokenizer, data[0]);
+    switch (tokenizer->matcher) {
+#ifdef RWKV_GENERATED_MATCHER
+    case MATCHER_GENERATED:
+        return findLongestGenerated(data, data_length, endIndex);
+#endif
+    case MATCHER_CJK:
+        return findLongestCJK(tokenizer, data, data_length, endIndex);
+    default:
+        return findLongest(tokenizer->root, data, data_length, endIndex);
+    }
+}
+
+const char* matcherName(MatcherKind matcher) {
+    switch (matcher) {
+    case MATCHER_TRIE: return "trie";
+    case MATCHER_CJK: return "cjk";
+    case MATCHER_GENERATED: return "generated";
+    default: return "unknown";
+    }
+}
+
+bool matcherAvailable(const Tokenizer* tokenizer, MatcherKind matcher) {
+    switch (matcher) {
+    case MATCHER_TRIE:
+        return true;
+    case MATCHER_CJK:
+        return tokenizer->cjk_index != NULL;
+    case MATCHER_GENERATED:
+#ifdef RWKV_GENERATED_MATCHER
+        return tokenizer->vocab_hash == rwkv_generated_vocab_hash;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+Tokenizer* createTokenizer(void) {
     Tokenizer* tokenizer = (Tokenizer*)calloc(1, sizeof(Tokenizer));
     if (!tokenizer) {
         fprintf(stderr, "Memory allocation failed\n");
@@ -65,6 +232,11 @@ Tokenizer* createTokenizer() {
     }
     tokenizer->root = createTrieNode();
     tokenizer->num_tokens = 0;
+    tokenizer->max_token_id = -1;
+    tokenizer->vocab_hash = 14695981039346656037ULL;  // FNV-1a offset basis
+    for (int i = 0; i < 256; i++) {
+        tokenizer->byte_tokens[i] = (unsigned char)i;
+    }
     return tokenizer;
 }
 
@@ -122,6 +294,37 @@ int parse_python_literal(const char* literal, unsigned char* out, int out_len) {
     return len;
 }
 
+static void reserveTokens(Tokenizer* tokenizer, int id, int token_length) {
+    if (id >= tokenizer->token_capacity) {
+        long long capacity = tokenizer->token_capacity ? (long long)tokenizer->token_capacity * 2 : 1024;
+        if (capacity <= id) capacity = (long long)id + 1;
+        if (capacity > INT32_MAX) capacity = INT32_MAX;
+        size_t* offsets = (size_t*)realloc(tokenizer->token_offset, capacity * sizeof(size_t));
+        int* lengths = (int*)realloc(tokenizer->token_length, capacity * sizeof(int));
+        if (!offsets || !lengths) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int i = tokenizer->token_capacity; i < capacity; i++) {
+            lengths[i] = -1;
+        }
+        tokenizer->token_offset = offsets;
+        tokenizer->token_length = lengths;
+        tokenizer->token_capacity = capacity;
+    }
+    if (tokenizer->token_data_length + token_length > tokenizer->token_data_capacity) {
+        size_t capacity = tokenizer->token_data_capacity ? tokenizer->token_data_capacity : 64 * 1024;
+        while (capacity < tokenizer->token_data_length + token_length) capacity *= 2;
+        unsigned char* data = (unsigned char*)realloc(tokenizer->token_data, capacity);
+        if (!data) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        tokenizer->token_data = data;
+        tokenizer->token_data_capacity = capacity;
+    }
+}
+
 void addToken(Tokenizer* tokenizer, const char* token_literal, int id) {
     unsigned char token[MAX_TOKEN_LENGTH];
     int token_length = parse_python_literal(token_literal, token, MAX_TOKEN_LENGTH);
@@ -131,53 +334,190 @@ void addToken(Tokenizer* tokenizer, const char* token_literal, int id) {
         return;
     }
     
-    insertTrie(tokenizer->root, token, token_length, id);
-    tokenizer->idx2token[id] = (unsigned char*)malloc(token_length + 1);
-    if (!tokenizer->idx2token[id]) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
+    if (id < 0 || id == INT32_MAX) {
+        fprintf(stderr, "Token ID out of range: %d\n", id);
+        return;
+    }
+
+    LazyTrie* lazy = tokenizer->lazy;
+    if (lazy && token_length > 0 && !atomic_load_explicit(&lazy->built[token[0]], memory_order_relaxed)) {
+        unsigned char c = token[0];
+        if (lazy->num_pending[c] == lazy->pending_capacity[c]) {
+            int capacity = lazy->pending_capacity[c] ? lazy->pending_capacity[c] * 2 : 64;
+            int* pending = (int*)realloc(lazy->pending[c], capacity * sizeof(int));
+            if (!pending) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+            lazy->pending[c] = pending;
+            lazy->pending_capacity[c] = capacity;
+        }
+        lazy->pending[c][lazy->num_pending[c]++] = id;
+    } else {
+        insertTrie(tokenizer->root, token, token_length, id);
+    }
+    if (tokenizer->cjk_index && token_length > 0 && (token[0] & 0xF0) == 0xE0) {
+        free(tokenizer->cjk_index);
+        tokenizer->cjk_index = NULL;
+    }
+    reserveTokens(tokenizer, id, token_length);
+    if (tokenizer->token_length[id] == -1) tokenizer->num_tokens++;
+    if (id > tokenizer->max_token_id) tokenizer->max_token_id = id;
+    memcpy(tokenizer->token_data + tokenizer->token_data_length, token, token_length);
+    tokenizer->token_offset[id] = tokenizer->token_data_length;
+    tokenizer->token_length[id] = token_length;
+    tokenizer->token_data_length += token_length;
+
+    uint64_t hash = tokenizer->vocab_hash;
+    for (int shift = 0; shift < 32; shift += 8) {
+        hash = (hash ^ ((unsigned)id >> shift & 0xFF)) * 1099511628211ULL;
     }
-    memcpy(tokenizer->idx2token[id], token, token_length);
-    tokenizer->idx2token[id][token_length] = '\0';
-    tokenizer->token2idx[id] = id;
-    tokenizer->num_tokens++;
+    for (int i = 0; i < token_length; i++) {
+        hash = (hash ^ token[i]) * 1099511628211ULL;
+    }
+    tokenizer->vocab_hash = (hash ^ 0xFF) * 1099511628211ULL;  // token separator
+    tokenizer->matcher = MATCHER_TRIE;
 }
 
 int* encode(Tokenizer* tokenizer, const char* text, int* num_encoded) {
-    int length = strlen(text);
-    int* encoded = (int*)malloc(length * sizeof(int));
+    return encodeBytes(tokenizer, text, strlen(text), num_encoded);
+}
+
+int* encodeBytes(Tokenizer* tokenizer, const char* data, int length, int* num_encoded) {
+    int* encoded = (int*)malloc((length > 0 ? length : 1) * sizeof(int));
     if (!encoded) {
         fprintf(stderr, "Memory allocation failed\n");
         exit(1);
     }
-    *num_encoded = 0;
+    *num_encoded = encodeInto(tokenizer, data, length, encoded);
+    return encoded;
+}
+
+int encodeInto(Tokenizer* tokenizer, const char* data, int length, int* out) {
+    int num_encoded = 0;
     int index = 0;
     while (index < length) {
         int endIndex;
-        int id = findLongest(tokenizer->root, (const unsigned char*)text + index, length - index, &endIndex);
-        if (endIndex == index || id == -1) {
-            encoded[(*num_encoded)++] = (unsigned char)text[index];
+        int id = matchToken(tokenizer, (const unsigned char*)data + index, length - index, &endIndex);
+        if (endIndex == 0 || id == -1) {
+            out[num_encoded++] = (unsigned char)data[index];
             index++;
         } else {
-            encoded[(*num_encoded)++] = id;
+            out[num_encoded++] = id;
             index += endIndex;
         }
     }
-    return encoded;
+    return num_encoded;
+}
+
+int nextToken(const Tokenizer* tokenizer, const char* data, int length, int* id) {
+    int endIndex;
+    int value = matchToken(tokenizer, (const unsigned char*)data, length, &endIndex);
+    if (endIndex == 0 || value == -1) {
+        *id = (unsigned char)data[0];
+        return 1;
+    }
+    *id = value;
+    return endIndex;
+}
+
+int matchLookahead(const Tokenizer* tokenizer, const char* data, int length) {
+    if (length == 0) return 0;
+    ensureSubtrie(tokenizer, (unsigned char)data[0]);
+    const TrieNode* node = tokenizer->root;
+    int depth = 0;
+    while (depth < length && (node = trieChild(node, (unsigned char)data[depth]))) {
+        depth++;
+    }
+    return depth;
+}
+
+// Copies up to `capacity` bytes starting `offset` bytes into fragment `f`.
+static int gatherFragments(const struct iovec* fragments, int num_fragments, int f, size_t offset,
+                           unsigned char* out, int capacity) {
+    int length = 0;
+    for (; f < num_fragments && length < capacity; f++, offset = 0) {
+        size_t available = fragments[f].iov_len - offset;
+        int n = available < (size_t)(capacity - length) ? (int)available : capacity - length;
+        memcpy(out + length, (const unsigned char*)fragments[f].iov_base + offset, n);
+        length += n;
+    }
+    return length;
+}
+
+int encodeFragments(Tokenizer* tokenizer, const struct iovec* fragments, int num_fragments, int* out) {
+    // No token is longer than MAX_TOKEN_LENGTH, so a match starting at least
+    // that far from a fragment's end never sees the boundary.
+    unsigned char window[2 * MAX_TOKEN_LENGTH];
+    int last = num_fragments - 1;
+    while (last >= 0 && fragments[last].iov_len == 0) last--;
+
+    int num_encoded = 0;
+    int f = 0;
+    size_t offset = 0;
+    while (f <= last) {
+        const unsigned char* data = (const unsigned char*)fragments[f].iov_base;
+        size_t length = fragments[f].iov_len;
+        size_t safe_end = f == last ? length : (length > MAX_TOKEN_LENGTH ? length - MAX_TOKEN_LENGTH : 0);
+        while (offset < safe_end) {
+            int endIndex;
+            int id = matchToken(tokenizer, data + offset, (int)(length - offset), &endIndex);
+            if (endIndex == 0 || id == -1) {
+                out[num_encoded++] = data[offset];
+                offset++;
+            } else {
+                out[num_encoded++] = id;
+                offset += endIndex;
+            }
+        }
+        if (offset >= length) {
+            f++;
+            offset = 0;
+            continue;
+        }
+
+        // Near a boundary: match inside a copy of the next 2 * MAX_TOKEN_LENGTH
+        // bytes, while every match still has a full token's lookahead (or
+        // the window reaches the end of the input).
+        int window_length = gatherFragments(fragments, last + 1, f, offset, window, sizeof(window));
+        bool final = window_length < (int)sizeof(window);
+        int position = 0;
+        while (position < window_length && (final || position + MAX_TOKEN_LENGTH <= window_length)) {
+            int endIndex;
+            int id = matchToken(tokenizer, window + position, window_length - position, &endIndex);
+            if (endIndex == 0 || id == -1) {
+                out[num_encoded++] = window[position];
+                position++;
+            } else {
+                out[num_encoded++] = id;
+                position += endIndex;
+            }
+        }
+        size_t skip = position;
+        while (f <= last && skip >= fragments[f].iov_len - offset) {
+            skip -= fragments[f].iov_len - offset;
+            f++;
+            offset = 0;
+        }
+        offset += skip;
+    }
+    return num_encoded;
 }
 
 char* decode(Tokenizer* tokenizer, const int* tokens, int num_tokens) {
+    int length;
+    return decodeBytes(tokenizer, tokens, num_tokens, &length);
+}
+
+char* decodeBytes(Tokenizer* tokenizer, const int* tokens, int num_tokens, int* decoded_length) {
     int total_length = 0;
     for (int i = 0; i < num_tokens; i++) {
-        int id = tokens[i];
-        if (id < 256) {
-            total_length += 1;  // Single byte character
-        } else if (id < tokenizer->num_tokens && tokenizer->idx2token[id]) {
-            total_length += strlen((char*)tokenizer->idx2token[id]);
-        } else {
-            fprintf(stderr, "Unknown token ID: %d\n", id);
+        int length;
+        if (!tokenBytes(tokenizer, tokens[i], &length)) {
+            fprintf(stderr, "Unknown token ID: %d\n", tokens[i]);
             return NULL;
         }
+        total_length += length;
     }
     char* decoded = (char*)malloc((total_length + 1) * sizeof(char));
     if (!decoded) {
@@ -186,73 +526,933 @@ char* decode(Tokenizer* tokenizer, const int* tokens, int num_tokens) {
     }
     char* ptr = decoded;
     for (int i = 0; i < num_tokens; i++) {
-        int id = tokens[i];
-        if (id < 256) {
-            *ptr++ = (char)id;
-        } else if (id < tokenizer->num_tokens && tokenizer->idx2token[id]) {
-            int length = strlen((char*)tokenizer->idx2token[id]);
-            memcpy(ptr, tokenizer->idx2token[id], length);
-            ptr += length;
-        }
+        int length;
+        const unsigned char* bytes = tokenBytes(tokenizer, tokens[i], &length);
+        memcpy(ptr, bytes, length);
+        ptr += length;
     }
     *ptr = '\0';
+    *decoded_length = total_length;
     return decoded;
 }
 
+int decodeInto(const Tokenizer* tokenizer, const int* tokens, int num_tokens, char* out, int capacity) {
+    int total_length = 0;
+    for (int i = 0; i < num_tokens; i++) {
+        int length;
+        const unsigned char* bytes = tokenBytes(tokenizer, tokens[i], &length);
+        if (!bytes) {
+            fprintf(stderr, "Unknown token ID: %d\n", tokens[i]);
+            return -1;
+        }
+        if (length > capacity - total_length) {
+            return -1;
+        }
+        memcpy(out + total_length, bytes, length);
+        total_length += length;
+    }
+    return total_length;
+}
+
+const unsigned char* tokenBytes(const Tokenizer* tokenizer, int id, int* length) {
+    if (id >= 0 && id < tokenizer->token_capacity && tokenizer->token_length[id] != -1) {
+        *length = tokenizer->token_length[id];
+        return tokenizer->token_data + tokenizer->token_offset[id];
+    }
+    if (id >= 0 && id < 256) {
+        *length = 1;
+        return &tokenizer->byte_tokens[id];
+    }
+    *length = 0;
+    return NULL;
+}
+
+int decodeViews(const Tokenizer* tokenizer, const int* tokens, int num_tokens, struct iovec* views) {
+    int num_views = 0;
+    for (int i = 0; i < num_tokens; i++) {
+        int length;
+        const unsigned char* bytes = tokenBytes(tokenizer, tokens[i], &length);
+        if (!bytes) {
+            fprintf(stderr, "Unknown token ID: %d\n", tokens[i]);
+            return -1;
+        }
+        if (num_views > 0 && (const unsigned char*)views[num_views - 1].iov_base + views[num_views - 1].iov_len == bytes) {
+            views[num_views - 1].iov_len += length;
+        } else if (length > 0) {
+            views[num_views].iov_base = (void*)bytes;
+            views[num_views].iov_len = length;
+            num_views++;
+        }
+    }
+    return num_views;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+ssize_t writeViews(int fd, const struct iovec* views, int num_views) {
+    // writev() may stop anywhere, so each batch is copied and trimmed from
+    // the front as it drains.
+    struct iovec batch[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    ssize_t total = 0;
+    int next = 0;
+    while (next < num_views) {
+        int count = num_views - next;
+        if (count > (int)(sizeof(batch) / sizeof(batch[0]))) count = (int)(sizeof(batch) / sizeof(batch[0]));
+        memcpy(batch, views + next, count * sizeof(struct iovec));
+        next += count;
+        struct iovec* pending = batch;
+        while (count > 0) {
+            ssize_t written = writev(fd, pending, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            total += written;
+            while (count > 0 && (size_t)written >= pending->iov_len) {
+                written -= pending->iov_len;
+                pending++;
+                count--;
+            }
+            if (count > 0) {
+                pending->iov_base = (char*)pending->iov_base + written;
+                pending->iov_len -= written;
+            }
+        }
+    }
+    return total;
+}
+
+// Each iovec costs the kernel about as much as copying a few dozen bytes,
+// so short tokens are packed into a staging buffer and only long ones are
+// written from the token blob in place.
+#define DECODE_FD_INLINE_LIMIT 64
+#define DECODE_FD_STAGING 16384
+
+ssize_t decodeToFd(const Tokenizer* tokenizer, const int* tokens, int num_tokens, int fd) {
+    struct iovec views[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    unsigned char staging[DECODE_FD_STAGING];
+    int max_views = (int)(sizeof(views) / sizeof(views[0]));
+    int num_views = 0;
+    int staged = 0;
+    bool staging_open = false;  // the last view ends at staging + staged
+    ssize_t total = 0;
+    for (int i = 0; i <= num_tokens; i++) {
+        int length = 0;
+        const unsigned char* bytes = NULL;
+        if (i < num_tokens) {
+            bytes = tokenBytes(tokenizer, tokens[i], &length);
+            if (!bytes) {
+                fprintf(stderr, "Unknown token ID: %d\n", tokens[i]);
+                return -1;
+            }
+        }
+        bool inline_copy = length < DECODE_FD_INLINE_LIMIT;
+        if (i == num_tokens || num_views + 2 > max_views || (inline_copy && staged + length > DECODE_FD_STAGING)) {
+            ssize_t written = writeViews(fd, views, num_views);
+            if (written < 0) return -1;
+            total += written;
+            num_views = 0;
+            staged = 0;
+            staging_open = false;
+            if (i == num_tokens) break;
+        }
+        if (inline_copy) {
+            if (!staging_open) {
+                views[num_views].iov_base = staging + staged;
+                views[num_views].iov_len = 0;
+                num_views++;
+                staging_open = true;
+            }
+            memcpy(staging + staged, bytes, length);
+            staged += length;
+            views[num_views - 1].iov_len += length;
+        } else {
+            views[num_views].iov_base = (void*)bytes;
+            views[num_views].iov_len = length;
+            num_views++;
+            staging_open = false;
+        }
+    }
+    return total;
+}
+
+#define UTF16_CHUNK 8192
+
+// Transcodes until the input ends or fewer than 4 bytes of room are left,
+// and returns the bytes written.
+static int utf16ToUtf8(const uint16_t* in, int length, int* consumed, unsigned char* out, int capacity) {
+    int i = 0;
+    int o = 0;
+    while (i < length && capacity - o >= 4) {
+#ifdef __SSE2__
+        if (length - i >= 16 && capacity - o >= 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 8));
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xFF80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF) {
+                _mm_storeu_si128((__m128i*)(out + o), _mm_packus_epi16(a, b));
+                i += 16;
+                o += 16;
+                continue;
+            }
+        }
+#endif
+        unsigned c = in[i++];
+        if (c < 0x80) {
+            out[o++] = (unsigned char)c;
+            continue;
+        }
+        if (c < 0x800) {
+            out[o++] = (unsigned char)(0xC0 | (c >> 6));
+            out[o++] = (unsigned char)(0x80 | (c & 0x3F));
+            continue;
+        }
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            if (c <= 0xDBFF && i < length && in[i] >= 0xDC00 && in[i] <= 0xDFFF) {
+                unsigned cp = 0x10000 + ((c - 0xD800) << 10) + (in[i++] - 0xDC00);
+                out[o++] = (unsigned char)(0xF0 | (cp >> 18));
+                out[o++] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+                out[o++] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+                out[o++] = (unsigned char)(0x80 | (cp & 0x3F));
+                continue;
+            }
+            c = 0xFFFD;
+        }
+        out[o++] = (unsigned char)(0xE0 | (c >> 12));
+        out[o++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+        out[o++] = (unsigned char)(0x80 | (c & 0x3F));
+    }
+    *consumed = i;
+    return o;
+}
+
+int encodeUtf16(Tokenizer* tokenizer, const uint16_t* text, int length, int* out) {
+    // Tokens are matched in place in the transcoded chunk while a full
+    // token of lookahead is available; the rest moves to the front and the
+    // chunk is refilled.
+    unsigned char buffer[UTF16_CHUNK];
+    int filled = 0;
+    int position = 0;
+    int consumed_total = 0;
+    int num_encoded = 0;
+    for (;;) {
+        if (consumed_total < length) {
+            memmove(buffer, buffer + position, filled - position);
+            filled -= position;
+            position = 0;
+            int consumed;
+            filled += utf16ToUtf8(text + consumed_total, length - consumed_total, &consumed,
+                                  buffer + filled, (int)sizeof(buffer) - filled);
+            consumed_total += consumed;
+        }
+        bool final = consumed_total >= length;
+        int limit = final ? filled : filled - MAX_TOKEN_LENGTH;
+        while (position < limit) {
+            int endIndex;
+            int id = matchToken(tokenizer, buffer + position, filled - position, &endIndex);
+            if (endIndex == 0 || id == -1) {
+                out[num_encoded++] = buffer[position];
+                position++;
+            } else {
+                out[num_encoded++] = id;
+                position += endIndex;
+            }
+        }
+        if (final) break;
+    }
+    return num_encoded;
+}
+
+// Transcodes whole UTF-8 sequences and returns the bytes consumed; unless
+// `final`, an incomplete sequence at the end is left for the next call.
+// Returns -1 if `out` runs out of room.
+static int utf8ToUtf16(const unsigned char* in, int length, bool final, uint16_t* out, int capacity, int* written) {
+    int i = 0;
+    int o = 0;
+    while (i < length) {
+#ifdef __SSE2__
+        if (length - i >= 16 && capacity - o >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+            if (_mm_movemask_epi8(v) == 0) {
+                _mm_storeu_si128((__m128i*)(out + o), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+                _mm_storeu_si128((__m128i*)(out + o + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+                i += 16;
+                o += 16;
+                continue;
+            }
+        }
+#endif
+        unsigned c = in[i];
+        int need = c < 0x80 ? 1 : c < 0xC2 ? 0 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+        bool valid = need > 0;
+        bool incomplete = false;
+        for (int k = 1; valid && k < need; k++) {
+            if (i + k >= length) {
+                incomplete = true;
+                break;
+            }
+            unsigned b = in[i + k];
+            unsigned lo = 0x80, hi = 0xBF;
+            if (k == 1) {
+                if (c == 0xE0) lo = 0xA0;        // overlong
+                else if (c == 0xED) hi = 0x9F;   // surrogate
+                else if (c == 0xF0) lo = 0x90;   // overlong
+                else if (c == 0xF4) hi = 0x8F;   // above U+10FFFF
+            }
+            valid = b >= lo && b <= hi;
+        }
+        if (incomplete && !final) break;
+        if (!valid || incomplete) {
+            if (o >= capacity) return -1;
+            out[o++] = 0xFFFD;
+            i++;
+            continue;
+        }
+        unsigned cp;
+        switch (need) {
+        case 1: cp = c; break;
+        case 2: cp = ((c & 0x1F) << 6) | (in[i + 1] & 0x3F); break;
+        case 3: cp = ((c & 0x0F) << 12) | ((in[i + 1] & 0x3F) << 6) | (in[i + 2] & 0x3F); break;
+        default: cp = ((c & 0x07) << 18) | ((in[i + 1] & 0x3F) << 12) | ((in[i + 2] & 0x3F) << 6) | (in[i + 3] & 0x3F); break;
+        }
+        if (cp >= 0x10000) {
+            if (capacity - o < 2) return -1;
+            out[o++] = (uint16_t)(0xD800 + ((cp - 0x10000) >> 10));
+            out[o++] = (uint16_t)(0xDC00 + ((cp - 0x10000) & 0x3FF));
+        } else {
+            if (o >= capacity) return -1;
+            out[o++] = (uint16_t)cp;
+        }
+        i += need;
+    }
+    *written = o;
+    return i;
+}
+
+int decodeUtf16(const Tokenizer* tokenizer, const int* tokens, int num_tokens, uint16_t* out, int capacity) {
+    unsigned char buffer[UTF16_CHUNK];
+    int pending = 0;
+    int written_total = 0;
+    int t = 0;
+    for (;;) {
+        while (t < num_tokens) {
+            int length;
+            const unsigned char* bytes = tokenBytes(tokenizer, tokens[t], &length);
+            if (!bytes) {
+                fprintf(stderr, "Unknown token ID: %d\n", tokens[t]);
+                return -1;
+            }
+            if (pending + length > (int)sizeof(buffer)) break;
+            memcpy(buffer + pending, bytes, length);
+            pending += length;
+            t++;
+        }
+        bool final = t == num_tokens;
+        int written;
+        int used = utf8ToUtf16(buffer, pending, final, out + written_total, capacity - written_total, &written);
+        if (used < 0) return -1;
+        written_total += written;
+        memmove(buffer, buffer + used, pending - used);
+        pending -= used;
+        if (final) break;
+    }
+    return written_total;
+}
+
+static void* threadPoolWorker(void* arg) {
+    ThreadPool* pool = (ThreadPool*)arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stop) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (!pool->head) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        ThreadPoolTask* task = pool->head;
+        pool->head = task->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+    }
+}
+
+ThreadPool* createThreadPool(int num_threads) {
+    if (num_threads < 1) num_threads = 1;
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    if (!pool || !threads) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, threadPoolWorker, pool) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads == 0) {
+        exit(1);
+    }
+    return pool;
+}
+
+void threadPoolSubmit(ThreadPool* pool, void (*fn)(void* arg), void* arg) {
+    ThreadPoolTask* task = (ThreadPoolTask*)malloc(sizeof(ThreadPoolTask));
+    if (!task) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Drains the queue, then joins the workers.
+void freeThreadPool(ThreadPool* pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->threads);
+    free(pool);
+}
+
+typedef struct {
+    Tokenizer* tokenizer;
+    const char* const* texts;
+    const int* lengths;
+    int num_texts;
+    EncodedText* out;
+    atomic_int next;
+    int pending;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} BatchJob;
+
+static void encodeBatchWorker(void* arg) {
+    BatchJob* job = (BatchJob*)arg;
+    int i;
+    while ((i = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) < job->num_texts) {
+        job->out[i].ids = encodeBytes(job->tokenizer, job->texts[i], job->lengths[i], &job->out[i].num_ids);
+    }
+    pthread_mutex_lock(&job->lock);
+    if (--job->pending == 0) {
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+void encodeBatch(Tokenizer* tokenizer, ThreadPool* pool, const char* const* texts,
+                 const int* lengths, int num_texts, EncodedText* out) {
+    if (num_texts <= 0) return;
+    BatchJob job;
+    job.tokenizer = tokenizer;
+    job.texts = texts;
+    job.lengths = lengths;
+    job.num_texts = num_texts;
+    job.out = out;
+    atomic_init(&job.next, 0);
+    job.pending = num_texts < pool->num_threads ? num_texts : pool->num_threads;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    int workers = job.pending;
+    for (int i = 0; i < workers; i++) {
+        threadPoolSubmit(pool, encodeBatchWorker, &job);
+    }
+    pthread_mutex_lock(&job.lock);
+    while (job.pending > 0) {
+        pthread_cond_wait(&job.done, &job.lock);
+    }
+    pthread_mutex_unlock(&job.lock);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.done);
+}
+
+typedef struct {
+    Tokenizer* tokenizer;
+    const char* const* texts;
+    const int* lengths;
+    int num_texts;
+    TokenBatch* batch;
+    int64_t* counts;
+    atomic_int next;
+    atomic_bool overflow;
+    int pending;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} PackedBatchJob;
+
+// Each text gets a slot as large as its byte length (the most ids it can
+// produce), starting at batch->offsets[i]; the slots are compacted afterwards.
+static void encodeBatchPackedWorker(void* arg) {
+    PackedBatchJob* job = (PackedBatchJob*)arg;
+    int i;
+    while ((i = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) < job->num_texts) {
+        const unsigned char* data = (const unsigned char*)job->texts[i];
+        int length = job->lengths[i];
+        uint16_t* out = job->batch->ids + job->batch->offsets[i];
+        int64_t count = 0;
+        int index = 0;
+        while (index < length) {
+            int endIndex;
+            int id = matchToken(job->tokenizer, data + index, length - index, &endIndex);
+            if (endIndex == 0 || id == -1) {
+                id = data[index];
+                endIndex = 1;
+            }
+            if (id > UINT16_MAX) {
+                atomic_store_explicit(&job->overflow, true, memory_order_relaxed);
+            }
+            out[count++] = (uint16_t)id;
+            index += endIndex;
+        }
+        job->counts[i] = count;
+    }
+    pthread_mutex_lock(&job->lock);
+    if (--job->pending == 0) {
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+TokenBatch* encodeBatchPacked(Tokenizer* tokenizer, ThreadPool* pool, const char* const* texts,
+                              const int* lengths, int num_texts) {
+    if (num_texts < 0) return NULL;
+    TokenBatch* batch = (TokenBatch*)calloc(1, sizeof(TokenBatch));
+    int64_t* offsets = (int64_t*)malloc((num_texts + 1) * sizeof(int64_t));
+    int64_t* counts = (int64_t*)malloc((num_texts > 0 ? num_texts : 1) * sizeof(int64_t));
+    if (!batch || !offsets || !counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    int64_t capacity = 0;
+    for (int i = 0; i < num_texts; i++) {
+        offsets[i] = capacity;
+        capacity += lengths[i];
+    }
+    offsets[num_texts] = capacity;
+    batch->num_texts = num_texts;
+    batch->offsets = offsets;
+    batch->ids = (uint16_t*)malloc((capacity > 0 ? capacity : 1) * sizeof(uint16_t));
+    if (!batch->ids) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    PackedBatchJob job;
+    job.tokenizer = tokenizer;
+    job.texts = texts;
+    job.lengths = lengths;
+    job.num_texts = num_texts;
+    job.batch = batch;
+    job.counts = counts;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.overflow, false);
+    job.pending = num_texts < pool->num_threads ? num_texts : pool->num_threads;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    int workers = job.pending;
+    for (int i = 0; i < workers; i++) {
+        threadPoolSubmit(pool, encodeBatchPackedWorker, &job);
+    }
+    pthread_mutex_lock(&job.lock);
+    while (job.pending > 0) {
+        pthread_cond_wait(&job.done, &job.lock);
+    }
+    pthread_mutex_unlock(&job.lock);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.done);
+
+    if (atomic_load(&job.overflow)) {
+        fprintf(stderr, "Token ID does not fit in 16 bits\n");
+        free(counts);
+        freeTokenBatch(batch);
+        return NULL;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < num_texts; i++) {
+        if (batch->offsets[i] != total) {
+            memmove(batch->ids + total, batch->ids + batch->offsets[i], counts[i] * sizeof(uint16_t));
+        }
+        batch->offsets[i] = total;
+        total += counts[i];
+    }
+    batch->offsets[num_texts] = total;
+    free(counts);
+    uint16_t* shrunk = (uint16_t*)realloc(batch->ids, (total > 0 ? total : 1) * sizeof(uint16_t));
+    if (shrunk) batch->ids = shrunk;
+    return batch;
+}
+
+void freeTokenBatch(TokenBatch* batch) {
+    if (!batch) return;
+    free(batch->offsets);
+    free(batch->ids);
+    free(batch);
+}
+
 void freeTrieNode(TrieNode* node) {
     if (!node) return;
-    for (int i = 0; i < 256; i++) {
+    int slots = node->dense ? 256 : node->num_children;
+    for (int i = 0; i < slots; i++) {
         if (node->children[i]) {
             freeTrieNode(node->children[i]);
         }
     }
+    free(node->children);
     free(node);
 }
 
 void freeTokenizer(Tokenizer* tokenizer) {
-    freeTrieNode(tokenizer->root);
-    for (int i = 0; i < tokenizer->num_tokens; i++) {
-        free(tokenizer->idx2token[i]);
+    if (tokenizer->lazy) {
+        for (int c = 0; c < 256; c++) {
+            free(tokenizer->lazy->pending[c]);
+        }
+        pthread_mutex_destroy(&tokenizer->lazy->lock);
+        free(tokenizer->lazy);
     }
+    freeTrieNode(tokenizer->root);
+    free(tokenizer->cjk_index);
+    free(tokenizer->token_data);
+    free(tokenizer->token_offset);
+    free(tokenizer->token_length);
     free(tokenizer);
 }
 
-int main() {
-    Tokenizer* tokenizer = createTokenizer();
-    
-    FILE* file = fopen("rwkv_vocab_v20230424.txt", "r");
+static size_t trieMemoryUsage(const TrieNode* node) {
+    size_t bytes = sizeof(TrieNode) + (node->dense ? 256 : node->capacity) * sizeof(TrieNode*);
+    int slots = node->dense ? 256 : node->num_children;
+    for (int i = 0; i < slots; i++) {
+        if (node->children[i]) bytes += trieMemoryUsage(node->children[i]);
+    }
+    return bytes;
+}
+
+size_t tokenizerMemoryUsage(const Tokenizer* tokenizer) {
+    size_t bytes = sizeof(Tokenizer) + trieMemoryUsage(tokenizer->root);
+    bytes += tokenizer->token_data_capacity;
+    bytes += (size_t)tokenizer->token_capacity * (sizeof(size_t) + sizeof(int));
+    if (tokenizer->cjk_index) bytes += 0x10000 * sizeof(CjkEntry);
+    if (tokenizer->lazy) {
+        bytes += sizeof(LazyTrie);
+        for (int c = 0; c < 256; c++) {
+            bytes += tokenizer->lazy->pending_capacity[c] * sizeof(int);
+        }
+    }
+    return bytes;
+}
+
+static int readVocab(Tokenizer* tokenizer, const char* path) {
+    FILE* file = fopen(path, "r");
     if (!file) {
-        fprintf(stderr, "Failed to open vocabulary file\n");
-        return 1;
+        fprintf(stderr, "Failed to open vocabulary file: %s\n", path);
+        return -1;
     }
-    
+
+    // Each line is "<id> <python literal> <byte length>"; the literal itself
+    // may contain spaces, so split on the first and last space only.
     char line[1024];
     while (fgets(line, sizeof(line), file)) {
-        int id;
-        char token[256];
-        int length;
-        
+        line[strcspn(line, "\r\n")] = 0;
+
+        char* first_space = strchr(line, ' ');
+        char* last_space = strrchr(line, ' ');
+        if (!first_space || last_space == first_space) {
+            fprintf(stderr, "Invalid line format: %s\n", line);
+            continue;
+        }
+        *last_space = '\0';
+        int id = atoi(line);
+        int length = atoi(last_space + 1);
+        if (id < 0) {
+            fprintf(stderr, "Token ID out of range: %d\n", id);
+            continue;
+        }
+
+        addToken(tokenizer, first_space + 1, id);
+        if (id < tokenizer->token_capacity && tokenizer->token_length[id] != -1 && tokenizer->token_length[id] != length) {
+            fprintf(stderr, "Token %d: expected %d bytes, parsed %d\n", id, length, tokenizer->token_length[id]);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+int loadVocab(Tokenizer* tokenizer, const char* path) {
+    if (readVocab(tokenizer, path) != 0) return -1;
+    buildCjkIndex(tokenizer);
+    tokenizer->matcher = matcherAvailable(tokenizer, MATCHER_GENERATED) ? MATCHER_GENERATED : MATCHER_CJK;
+    return 0;
+}
+
+int loadVocabLazy(Tokenizer* tokenizer, const char* path) {
+    if (!tokenizer->lazy) {
+        LazyTrie* lazy = (LazyTrie*)calloc(1, sizeof(LazyTrie));
+        TrieNode** table = (TrieNode**)calloc(256, sizeof(TrieNode*));
+        if (!lazy || !table) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        pthread_mutex_init(&lazy->lock, NULL);
+        // Subtries that already exist count as built.
+        TrieNode* root = tokenizer->root;
+        for (int c = 0; c < 256; c++) {
+            table[c] = trieChild(root, (unsigned char)c);
+            atomic_init(&lazy->built[c], table[c] != NULL);
+        }
+        if (!root->dense) {
+            free(root->children);
+            root->children = table;
+            root->dense = 1;
+        } else {
+            free(table);
+        }
+        tokenizer->lazy = lazy;
+    }
+    if (readVocab(tokenizer, path) != 0) return -1;
+    // The CJK index would force the E0-EF subtries, so stay on the trie.
+    tokenizer->matcher = matcherAvailable(tokenizer, MATCHER_GENERATED) ? MATCHER_GENERATED : MATCHER_TRIE;
+    return 0;
+}
+
+static const char* calibration_sample =
+    "The quick brown fox jumps over the lazy dog. It is given that $t$ is a common root of the "
+    "following two equations, where $a,b,c,d,e$ are real numbers.\n"
+    "我们今天在这里讨论一个问题，这个问题对所有人都很重要。日本語のテキストも少し含めます。\n"
+    "    for (int i = 0; i < n; i++) { total += values[i] * weights[i]; }\n";
+
+#define CALIBRATION_BUDGET_SECONDS 0.04
+#define CALIBRATION_MAX_SAMPLE (64 * 1024)
+
+static double monotonicSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void cpuModel(char* out, int out_len) {
+    snprintf(out, out_len, "unknown");
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    if (!file) return;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "model name", 10) == 0) {
+            char* value = strchr(line, ':');
+            if (value) {
+                value++;
+                while (*value == ' ' || *value == '\t') value++;
+                value[strcspn(value, "\n")] = 0;
+                snprintf(out, out_len, "%s", value);
+            }
+            break;
+        }
+    }
+    fclose(file);
+}
+
+static void defaultCalibrationPath(char* out, int out_len) {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cache_home && *cache_home) {
+        snprintf(out, out_len, "%s/rwkv_tokenizer_calibration", cache_home);
+    } else if (home && *home) {
+        snprintf(out, out_len, "%s/.cache/rwkv_tokenizer_calibration", home);
+    } else {
+        out[0] = '\0';
+    }
+}
+
+// Cache lines are "<vocab hash> <matcher> <cpu model>".
+static bool readCalibration(const char* path, uint64_t vocab_hash, const char* cpu, MatcherKind* matcher) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    char line[1024];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file)) {
         line[strcspn(line, "\n")] = 0;
-        
-        char* id_str = strtok(line, " ");
-        char* token_str = strtok(NULL, " ");
-        char* length_str = strtok(NULL, " ");
-        
-        if (id_str && token_str && length_str) {
-            id = atoi(id_str);
-            length = atoi(length_str);
-            
-            if (token_str[0] == '\'' || token_str[0] == '\"') {
-                memmove(token_str, token_str + 1, strlen(token_str));
-                token_str[strlen(token_str) - 1] = '\0';
+        uint64_t hash;
+        char name[32];
+        int offset;
+        if (sscanf(line, "%" SCNx64 " %31s %n", &hash, name, &offset) != 2) continue;
+        if (hash != vocab_hash || strcmp(line + offset, cpu) != 0) continue;
+        for (int m = 0; m < NUM_MATCHERS; m++) {
+            if (strcmp(name, matcherName((MatcherKind)m)) == 0) {
+                *matcher = (MatcherKind)m;
+                found = true;
             }
-            
-            addToken(tokenizer, token_str, id);
-        } else {
-            fprintf(stderr, "Invalid line format: %s\n", line);
         }
     }
     fclose(file);
+    return found;
+}
+
+// Replaces any entry for this vocab and CPU, keeping the others. The cache
+// is rewritten to a temporary file and renamed over the old one, so it does
+// not grow on every recalibration and concurrent readers never see it torn.
+static void writeCalibration(const char* path, uint64_t vocab_hash, const char* cpu, MatcherKind matcher) {
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(temp_path)) return;
+    FILE* out = fopen(temp_path, "w");
+    if (!out) return;
+    FILE* in = fopen(path, "r");
+    if (in) {
+        char line[1024];
+        while (fgets(line, sizeof(line), in)) {
+            uint64_t hash;
+            char name[32];
+            int offset;
+            if (sscanf(line, "%" SCNx64 " %31s %n", &hash, name, &offset) == 2 && hash == vocab_hash) {
+                size_t cpu_length = strcspn(line + offset, "\n");
+                if (cpu_length == strlen(cpu) && memcmp(line + offset, cpu, cpu_length) == 0) continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%016" PRIx64 " %s %s\n", vocab_hash, matcherName(matcher), cpu);
+    if (fclose(out) != 0 || rename(temp_path, path) != 0) unlink(temp_path);
+}
+
+MatcherKind calibrateMatcher(Tokenizer* tokenizer, const char* sample, int sample_length, const char* cache_path) {
+    char cpu[256];
+    char default_path[1024];
+    cpuModel(cpu, sizeof(cpu));
+    if (!cache_path) {
+        defaultCalibrationPath(default_path, sizeof(default_path));
+        cache_path = default_path[0] ? default_path : NULL;
+    }
+
+    MatcherKind cached;
+    if (cache_path && readCalibration(cache_path, tokenizer->vocab_hash, cpu, &cached) &&
+        matcherAvailable(tokenizer, cached)) {
+        tokenizer->matcher = cached;
+        return cached;
+    }
+
+    if (!sample) {
+        sample = calibration_sample;
+        sample_length = strlen(calibration_sample);
+    }
+    if (sample_length > CALIBRATION_MAX_SAMPLE) sample_length = CALIBRATION_MAX_SAMPLE;
+
+    int available = 0;
+    for (int m = 0; m < NUM_MATCHERS; m++) {
+        if (matcherAvailable(tokenizer, (MatcherKind)m)) available++;
+    }
+    int* reference = (int*)malloc((sample_length > 0 ? sample_length : 1) * sizeof(int));
+    int* out = (int*)malloc((sample_length > 0 ? sample_length : 1) * sizeof(int));
+    if (!reference || !out) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    tokenizer->matcher = MATCHER_TRIE;
+    int reference_count = encodeInto(tokenizer, sample, sample_length, reference);
+
+    // Each matcher gets an equal slice of the budget; the fastest single
+    // pass is kept so that a preempted pass does not skew the choice.
+    double slice = CALIBRATION_BUDGET_SECONDS / available;
+    MatcherKind best = MATCHER_TRIE;
+    double best_time = -1;
+    for (int m = 0; m < NUM_MATCHERS; m++) {
+        if (!matcherAvailable(tokenizer, (MatcherKind)m)) continue;
+        tokenizer->matcher = (MatcherKind)m;
+        int count = encodeInto(tokenizer, sample, sample_length, out);
+        if (count != reference_count || memcmp(out, reference, count * sizeof(int)) != 0) {
+            fprintf(stderr, "Matcher %s disagrees with trie, skipped\n", matcherName((MatcherKind)m));
+            continue;
+        }
+        double fastest = -1;
+        double start = monotonicSeconds();
+        double now = start;
+        while (now - start < slice) {
+            double pass_start = now;
+            encodeInto(tokenizer, sample, sample_length, out);
+            now = monotonicSeconds();
+            if (fastest < 0 || now - pass_start < fastest) fastest = now - pass_start;
+        }
+        if (best_time < 0 || fastest < best_time) {
+            best_time = fastest;
+            best = (MatcherKind)m;
+        }
+    }
+    free(reference);
+    free(out);
+
+    tokenizer->matcher = best;
+    if (cache_path) writeCalibration(cache_path, tokenizer->vocab_hash, cpu, best);
+    return best;
+}
+
+double measureEncodeRate(Tokenizer* tokenizer, const char* sample, int sample_length) {
+    if (!sample) {
+        sample = calibration_sample;
+        sample_length = strlen(calibration_sample);
+    }
+    if (sample_length > CALIBRATION_MAX_SAMPLE) sample_length = CALIBRATION_MAX_SAMPLE;
+    if (sample_length <= 0) return 0;
+    // The built-in sample is short, so it is repeated into a buffer large
+    // enough that per-call overhead does not inflate the time per byte.
+    int length = sample_length;
+    while (length * 2 <= CALIBRATION_MAX_SAMPLE) length *= 2;
+    char* text = (char*)malloc(length);
+    int* ids = (int*)malloc(length * sizeof(int));
+    if (!text || !ids) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < length; i += sample_length) {
+        memcpy(text + i, sample, length - i < sample_length ? length - i : sample_length);
+    }
+    double fastest = -1;
+    double start = monotonicSeconds();
+    double now = start;
+    while (now - start < CALIBRATION_BUDGET_SECONDS / 4) {
+        double pass_start = now;
+        encodeInto(tokenizer, text, length, ids);
+        now = monotonicSeconds();
+        if (fastest < 0 || now - pass_start < fastest) fastest = now - pass_start;
+    }
+    free(text);
+    free(ids);
+    return fastest > 0 ? length / fastest : 0;
+}
+
+#ifndef RWKV_TOKENIZER_NO_MAIN
+int main() {
+    Tokenizer* tokenizer = createTokenizer();
+    
+    if (loadVocab(tokenizer, "rwkv_vocab_v20230424.txt") != 0) {
+        freeTokenizer(tokenizer);
+        return 1;
+    }
     
     printf("Loaded %d tokens\n", tokenizer->num_tokens);
     
@@ -331,3 +1531,4 @@ Edit: For your example $(a,b,c,d,e)=(3,9,38,14,119)$ your equation II gives the
     freeTokenizer(tokenizer);
     return 0;
 }
+#endif
@@ -0,0 +1,207 @@
+#ifndef RWKV_TOKENIZER_H
+#define RWKV_TOKENIZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_TOKEN_LENGTH 256
+#define TRIE_SPARSE_CHILDREN 16
+
+// Nodes start sparse (edge bytes inline, scanned linearly) and switch to a
+// 256-entry table once they outgrow TRIE_SPARSE_CHILDREN, so the few wide
+// nodes near the root stay O(1) while the long tails of large vocabularies
+// cost tens of bytes per node instead of 2 KB.
+typedef struct TrieNode {
+    int value;
+    unsigned short num_children;
+    unsigned char dense;
+    unsigned char capacity;
+    unsigned char keys[TRIE_SPARSE_CHILDREN];
+    struct TrieNode** children;
+} TrieNode;
+
+static inline TrieNode* trieChild(const TrieNode* node, unsigned char c) {
+    if (node->dense) return node->children[c];
+    for (int i = 0; i < node->num_children; i++) {
+        if (node->keys[i] == c) return node->children[i];
+    }
+    return NULL;
+}
+
+// Result of matching one 3-byte UTF-8 character (U+0800..U+FFFF) from the
+// trie root: the node reached after its third byte (NULL if the trie ends
+// earlier) and the longest token found within those bytes.
+typedef struct {
+    TrieNode* node;
+    int value;
+    int length;
+} CjkEntry;
+
+// Interchangeable longest-match implementations; all produce the same ids.
+typedef enum {
+    MATCHER_TRIE,
+    MATCHER_CJK,
+    MATCHER_GENERATED,
+    NUM_MATCHERS
+} MatcherKind;
+
+typedef struct {
+    TrieNode* root;
+    CjkEntry* cjk_index;
+    struct LazyTrie* lazy;  // set by loadVocabLazy()
+    // Token bytes live back to back in token_data; id i is
+    // token_data[token_offset[i] .. + token_length[i]], or absent if
+    // token_length[i] is -1. Ids are only bounded by memory.
+    unsigned char* token_data;
+    size_t token_data_length;
+    size_t token_data_capacity;
+    size_t* token_offset;
+    int* token_length;
+    int token_capacity;
+    int max_token_id;
+    int num_tokens;
+    unsigned char byte_tokens[256];
+    uint64_t vocab_hash;
+    MatcherKind matcher;
+} Tokenizer;
+
+typedef struct ThreadPoolTask {
+    void (*fn)(void* arg);
+    void* arg;
+    struct ThreadPoolTask* next;
+} ThreadPoolTask;
+
+typedef struct {
+    pthread_t* threads;
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ThreadPoolTask* head;
+    ThreadPoolTask* tail;
+    bool stop;
+} ThreadPool;
+
+typedef struct {
+    int* ids;
+    int num_ids;
+} EncodedText;
+
+// Ragged batch in one allocation per buffer: the ids of text i are
+// ids[offsets[i]] .. ids[offsets[i + 1] - 1].
+typedef struct {
+    int num_texts;
+    int64_t* offsets;
+    uint16_t* ids;
+} TokenBatch;
+
+TrieNode* createTrieNode(void);
+void insertTrie(TrieNode* root, const unsigned char* key, int key_length, int value);
+int findLongest(TrieNode* root, const unsigned char* data, int data_length, int* endIndex);
+
+Tokenizer* createTokenizer(void);
+void addToken(Tokenizer* tokenizer, const char* token_literal, int id);
+// Indexes every 3-byte UTF-8 character by code point so matching CJK text
+// skips the first three trie levels. loadVocab() builds it; adding tokens
+// afterwards drops it until it is rebuilt.
+void buildCjkIndex(Tokenizer* tokenizer);
+int findLongestCJK(const Tokenizer* tokenizer, const unsigned char* data, int data_length, int* endIndex);
+
+const char* matcherName(MatcherKind matcher);
+bool matcherAvailable(const Tokenizer* tokenizer, MatcherKind matcher);
+// Times every available matcher on `sample` (a built-in text if NULL) and
+// switches the tokenizer to the fastest, within a total budget of about
+// 50 ms. The choice is cached in `cache_path` (NULL for
+// ~/.cache/rwkv_tokenizer_calibration) keyed by CPU model and vocabulary
+// hash, so later runs on the same machine skip the measurement.
+MatcherKind calibrateMatcher(Tokenizer* tokenizer, const char* sample, int sample_length, const char* cache_path);
+// Encode throughput of the current matcher in bytes/sec, measured on
+// `sample` (the calibration text if NULL) for about 10 ms.
+double measureEncodeRate(Tokenizer* tokenizer, const char* sample, int sample_length);
+
+#ifdef RWKV_GENERATED_MATCHER
+// Emitted by rwkv_gen_matcher for one fixed vocabulary. The tokenizer only
+// uses it when the loaded vocabulary hashes to rwkv_generated_vocab_hash.
+int findLongestGenerated(const unsigned char* data, int data_length, int* endIndex);
+extern const uint64_t rwkv_generated_vocab_hash;
+#endif
+int loadVocab(Tokenizer* tokenizer, const char* path);
+// Like loadVocab(), but only stores the tokens: the subtrie under each first
+// byte is built the first time encoding reaches that byte. Concurrent
+// encodes are safe; the first one to need a subtrie builds it.
+int loadVocabLazy(Tokenizer* tokenizer, const char* path);
+void freeTokenizer(Tokenizer* tokenizer);
+// Heap bytes held by the trie, token table and CJK index.
+size_t tokenizerMemoryUsage(const Tokenizer* tokenizer);
+
+int* encode(Tokenizer* tokenizer, const char* text, int* num_encoded);
+int* encodeBytes(Tokenizer* tokenizer, const char* data, int length, int* num_encoded);
+// Writes at most `length` ids to `out` and returns how many were written.
+int encodeInto(Tokenizer* tokenizer, const char* data, int length, int* out);
+// One greedy step: stores the id of the token at the start of `data` (a raw
+// byte id if no token matches) and returns how many bytes it covers.
+int nextToken(const Tokenizer* tokenizer, const char* data, int length, int* id);
+// How many leading bytes of `data` are a prefix of some token, i.e. how far
+// the matcher looks. If this is `length`, the token at `data` could change
+// when more bytes are appended.
+int matchLookahead(const Tokenizer* tokenizer, const char* data, int length);
+// Encodes the concatenation of the fragments without building it: tokens
+// that cross a boundary are matched in a small stitched window. `out` needs
+// room for as many ids as there are bytes in total.
+int encodeFragments(Tokenizer* tokenizer, const struct iovec* fragments, int num_fragments, int* out);
+char* decode(Tokenizer* tokenizer, const int* tokens, int num_tokens);
+// Bytes of a single token, for decoding one token at a time. The pointer
+// stays valid until more tokens are added. Returns NULL for unknown ids.
+const unsigned char* tokenBytes(const Tokenizer* tokenizer, int id, int* length);
+// Writes the decoded bytes (not NUL-terminated) to `out` without
+// allocating. Returns the byte count, or -1 on an unknown id or if the
+// output does not fit in `capacity` bytes.
+int decodeInto(const Tokenizer* tokenizer, const int* tokens, int num_tokens, char* out, int capacity);
+// Like decode(), but also reports the byte length, since tokens may contain NUL.
+char* decodeBytes(Tokenizer* tokenizer, const int* tokens, int num_tokens, int* decoded_length);
+// Points views at the bytes of each token inside the tokenizer instead of
+// copying them; tokens stored next to each other share one view. Returns
+// the number of views (at most num_tokens), or -1 on an unknown id. The
+// views stay valid until more tokens are added.
+int decodeViews(const Tokenizer* tokenizer, const int* tokens, int num_tokens, struct iovec* views);
+// Writes the views to `fd` with writev() in batches of IOV_MAX, continuing
+// after partial writes and EINTR. Returns the bytes written or -1.
+ssize_t writeViews(int fd, const struct iovec* views, int num_views);
+// Decodes straight to `fd` without allocating: long tokens are written from
+// the tokenizer in place, short ones through a small staging buffer.
+ssize_t decodeToFd(const Tokenizer* tokenizer, const int* tokens, int num_tokens, int fd);
+
+// UTF-16 in and out, transcoded chunk by chunk inside the encode/decode loop
+// rather than through a full UTF-8 copy. Unpaired surrogates encode as
+// U+FFFD; `out` needs room for 3 ids per code unit.
+int encodeUtf16(Tokenizer* tokenizer, const uint16_t* text, int length, int* out);
+// Returns the number of code units written, or -1 on an unknown id or if the
+// text does not fit in `capacity` units (one per decoded byte always fits).
+// Bytes that are not valid UTF-8 decode as U+FFFD each.
+int decodeUtf16(const Tokenizer* tokenizer, const int* tokens, int num_tokens, uint16_t* out, int capacity);
+
+ThreadPool* createThreadPool(int num_threads);
+void threadPoolSubmit(ThreadPool* pool, void (*fn)(void* arg), void* arg);
+void freeThreadPool(ThreadPool* pool);
+
+// Encodes texts[i] (lengths[i] bytes) into out[i] on the pool's workers and
+// returns once every text is done. Free each out[i].ids with free().
+void encodeBatch(Tokenizer* tokenizer, ThreadPool* pool, const char* const* texts,
+                 const int* lengths, int num_texts, EncodedText* out);
+// Same as encodeBatch() but packs everything into a TokenBatch. Returns NULL
+// if an id does not fit in 16 bits.
+TokenBatch* encodeBatchPacked(Tokenizer* tokenizer, ThreadPool* pool, const char* const* texts,
+                              const int* lengths, int num_texts);
+void freeTokenBatch(TokenBatch* batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+// C++20 ranges over the C tokenizer.
+//
+//   for (int id : rwkv::encode_view(tokenizer, text) | std::views::take(8)) ...
+//
+// encode_view matches one token per increment, straight from the text, so a
+// consumer that stops early never pays for the rest of the input, and
+// nothing is allocated.
+
+#ifndef RWKV_TOKENIZER_HPP
+#define RWKV_TOKENIZER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <string_view>
+#include "rwkv_tokenizer.h"
+
+namespace rwkv {
+
+class encode_view : public std::ranges::view_interface<encode_view> {
+public:
+    class iterator {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        // operator* returns a prvalue, so this is only a C++17 input iterator.
+        using iterator_category = std::input_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(const Tokenizer* tokenizer, const char* position, const char* end)
+            : tokenizer_(tokenizer), position_(position), end_(end) {
+            match();
+        }
+
+        int operator*() const { return id_; }
+        // Bytes of the input the current id covers.
+        std::string_view bytes() const { return {position_, static_cast<std::size_t>(length_)}; }
+
+        iterator& operator++() {
+            position_ += length_;
+            match();
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const iterator& other) const { return position_ == other.position_; }
+        bool operator==(std::default_sentinel_t) const { return position_ == end_; }
+
+    private:
+        void match() {
+            if (position_ == end_) return;
+            // No token is longer than MAX_TOKEN_LENGTH, so the matcher never
+            // needs to see more than that.
+            int available = static_cast<int>(std::min<std::ptrdiff_t>(end_ - position_, MAX_TOKEN_LENGTH));
+            length_ = nextToken(tokenizer_, position_, available, &id_);
+        }
+
+        const Tokenizer* tokenizer_ = nullptr;
+        const char* position_ = nullptr;
+        const char* end_ = nullptr;
+        int id_ = -1;
+        int length_ = 0;
+    };
+
+    encode_view() = default;
+    encode_view(const Tokenizer* tokenizer, std::string_view text) : tokenizer_(tokenizer), text_(text) {}
+    encode_view(const Tokenizer& tokenizer, std::string_view text) : encode_view(&tokenizer, text) {}
+
+    iterator begin() const { return iterator(tokenizer_, text_.data(), text_.data() + text_.size()); }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    const Tokenizer* tokenizer_ = nullptr;
+    std::string_view text_;
+};
+
+}  // namespace rwkv
+
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<rwkv::encode_view> = true;
+
+#endif
@@ -0,0 +1,346 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <unistd.h>
+#include "rwkv_tokenizer.h"
+
+// Token ids owned by the C encoder, exposed through the buffer protocol so
+// memoryview / array / numpy.frombuffer can read them without a copy.
+typedef struct {
+    PyObject_HEAD
+    int* ids;
+    Py_ssize_t num_ids;
+    Py_ssize_t shape[1];
+    Py_ssize_t strides[1];
+} TokenIdsObject;
+
+typedef struct {
+    PyObject_HEAD
+    Tokenizer* tokenizer;
+    ThreadPool* pool;
+} TokenizerObject;
+
+static PyTypeObject TokenIdsType;
+
+static PyObject* newTokenIds(int* ids, int num_ids) {
+    TokenIdsObject* self = PyObject_New(TokenIdsObject, &TokenIdsType);
+    if (!self) {
+        free(ids);
+        return NULL;
+    }
+    self->ids = ids;
+    self->num_ids = num_ids;
+    self->shape[0] = num_ids;
+    self->strides[0] = sizeof(int);
+    return (PyObject*)self;
+}
+
+static void TokenIds_dealloc(TokenIdsObject* self) {
+    free(self->ids);
+    PyObject_Free(self);
+}
+
+static int TokenIds_getbuffer(TokenIdsObject* self, Py_buffer* view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "token ids are read-only");
+        return -1;
+    }
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->buf = self->ids;
+    view->len = self->num_ids * (Py_ssize_t)sizeof(int);
+    view->readonly = 1;
+    view->itemsize = sizeof(int);
+    view->format = (flags & PyBUF_FORMAT) ? "i" : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t TokenIds_length(TokenIdsObject* self) {
+    return self->num_ids;
+}
+
+static PyObject* TokenIds_item(TokenIdsObject* self, Py_ssize_t i) {
+    if (i < 0 || i >= self->num_ids) {
+        PyErr_SetString(PyExc_IndexError, "token index out of range");
+        return NULL;
+    }
+    return PyLong_FromLong(self->ids[i]);
+}
+
+static PyBufferProcs TokenIds_as_buffer = {
+    .bf_getbuffer = (getbufferproc)TokenIds_getbuffer,
+};
+
+static PySequenceMethods TokenIds_as_sequence = {
+    .sq_length = (lenfunc)TokenIds_length,
+    .sq_item = (ssizeargfunc)TokenIds_item,
+};
+
+static PyTypeObject TokenIdsType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "rwkv_tokenizer.TokenIds",
+    .tp_basicsize = sizeof(TokenIdsObject),
+    .tp_dealloc = (destructor)TokenIds_dealloc,
+    .tp_as_sequence = &TokenIds_as_sequence,
+    .tp_as_buffer = &TokenIds_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Read-only int32 token ids supporting the buffer protocol.",
+};
+
+// str is accepted as UTF-8 for convenience; everything else must be a
+// contiguous bytes-like object.
+static int getInputBuffer(PyObject* obj, Py_buffer* view) {
+    if (PyUnicode_Check(obj)) {
+        Py_ssize_t length;
+        const char* data = PyUnicode_AsUTF8AndSize(obj, &length);
+        if (!data) return -1;
+        return PyBuffer_FillInfo(view, obj, (void*)data, length, 1, PyBUF_SIMPLE);
+    }
+    return PyObject_GetBuffer(obj, view, PyBUF_SIMPLE);
+}
+
+// NULL with RuntimeError set if __init__ never ran (e.g. Tokenizer.__new__).
+static Tokenizer* getTokenizer(TokenizerObject* self) {
+    if (!self->tokenizer) PyErr_SetString(PyExc_RuntimeError, "Tokenizer is not initialized");
+    return self->tokenizer;
+}
+
+static int Tokenizer_init(TokenizerObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"vocab_path", NULL};
+    const char* path = "rwkv_vocab_v20230424.txt";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &path)) {
+        return -1;
+    }
+    // Other threads may be encoding with the current tokenizer with the GIL
+    // released, so it is never replaced.
+    if (self->tokenizer) {
+        PyErr_SetString(PyExc_RuntimeError, "Tokenizer is already initialized");
+        return -1;
+    }
+    Tokenizer* tokenizer = createTokenizer();
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = loadVocab(tokenizer, path);
+    Py_END_ALLOW_THREADS
+    if (rc != 0) {
+        freeTokenizer(tokenizer);
+        PyErr_Format(PyExc_OSError, "failed to load vocabulary: %s", path);
+        return -1;
+    }
+    // Another thread may have initialized it while the GIL was released.
+    if (self->tokenizer) {
+        freeTokenizer(tokenizer);
+        PyErr_SetString(PyExc_RuntimeError, "Tokenizer is already initialized");
+        return -1;
+    }
+    self->tokenizer = tokenizer;
+    return 0;
+}
+
+static void Tokenizer_dealloc(TokenizerObject* self) {
+    freeThreadPool(self->pool);
+    if (self->tokenizer) freeTokenizer(self->tokenizer);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Tokenizer_encode(TokenizerObject* self, PyObject* arg) {
+    Tokenizer* tokenizer = getTokenizer(self);
+    if (!tokenizer) return NULL;
+    Py_buffer view;
+    if (getInputBuffer(arg, &view) != 0) return NULL;
+    if (view.len > INT_MAX) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_OverflowError, "input too large");
+        return NULL;
+    }
+    int* ids;
+    int num_ids;
+    Py_BEGIN_ALLOW_THREADS
+    ids = encodeBytes(tokenizer, (const char*)view.buf, (int)view.len, &num_ids);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    return newTokenIds(ids, num_ids);
+}
+
+static PyObject* Tokenizer_decode(TokenizerObject* self, PyObject* arg) {
+    Tokenizer* tokenizer = getTokenizer(self);
+    if (!tokenizer) return NULL;
+    Py_buffer view;
+    int* owned = NULL;
+    const int* ids;
+    Py_ssize_t num_ids;
+    bool have_view = false;
+
+    if (PyObject_CheckBuffer(arg) && PyObject_GetBuffer(arg, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+        have_view = true;
+        const char* format = view.format ? view.format : "B";
+        if (format[0] == '@' || format[0] == '=' || format[0] == '<') format++;
+        if (view.itemsize != sizeof(int) || (strcmp(format, "i") != 0 && strcmp(format, "I") != 0 && strcmp(format, "l") != 0)) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_TypeError, "decode expects a buffer of 32-bit ints");
+            return NULL;
+        }
+        ids = (const int*)view.buf;
+        num_ids = view.len / (Py_ssize_t)sizeof(int);
+    } else {
+        PyErr_Clear();
+        PyObject* seq = PySequence_Fast(arg, "decode expects a sequence of ints");
+        if (!seq) return NULL;
+        num_ids = PySequence_Fast_GET_SIZE(seq);
+        owned = (int*)PyMem_Malloc((num_ids > 0 ? num_ids : 1) * sizeof(int));
+        if (!owned) {
+            Py_DECREF(seq);
+            return PyErr_NoMemory();
+        }
+        for (Py_ssize_t i = 0; i < num_ids; i++) {
+            long id = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+            if (id == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                PyMem_Free(owned);
+                return NULL;
+            }
+            if (id < 0 || id > INT_MAX) {
+                Py_DECREF(seq);
+                PyMem_Free(owned);
+                if (id < 0) {
+                    PyErr_SetString(PyExc_ValueError, "unknown token id");
+                } else {
+                    PyErr_SetString(PyExc_OverflowError, "token id does not fit in 32 bits");
+                }
+                return NULL;
+            }
+            owned[i] = (int)id;
+        }
+        Py_DECREF(seq);
+        ids = owned;
+    }
+
+    char* decoded;
+    int length;
+    Py_BEGIN_ALLOW_THREADS
+    decoded = decodeBytes(tokenizer, ids, (int)num_ids, &length);
+    Py_END_ALLOW_THREADS
+    if (have_view) PyBuffer_Release(&view);
+    PyMem_Free(owned);
+    if (!decoded) {
+        PyErr_SetString(PyExc_ValueError, "unknown token id");
+        return NULL;
+    }
+    PyObject* result = PyBytes_FromStringAndSize(decoded, length);
+    free(decoded);
+    return result;
+}
+
+static PyObject* Tokenizer_encode_batch(TokenizerObject* self, PyObject* arg) {
+    Tokenizer* tokenizer = getTokenizer(self);
+    if (!tokenizer) return NULL;
+    PyObject* seq = PySequence_Fast(arg, "encode_batch expects a sequence of bytes-like objects");
+    if (!seq) return NULL;
+    Py_ssize_t num_texts = PySequence_Fast_GET_SIZE(seq);
+    if (num_texts > INT_MAX) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_OverflowError, "too many inputs");
+        return NULL;
+    }
+
+    Py_buffer* views = (Py_buffer*)PyMem_Calloc(num_texts ? num_texts : 1, sizeof(Py_buffer));
+    const char** texts = (const char**)PyMem_Calloc(num_texts ? num_texts : 1, sizeof(char*));
+    int* lengths = (int*)PyMem_Calloc(num_texts ? num_texts : 1, sizeof(int));
+    EncodedText* out = (EncodedText*)PyMem_Calloc(num_texts ? num_texts : 1, sizeof(EncodedText));
+    PyObject* result = NULL;
+    Py_ssize_t acquired = 0;
+    if (!views || !texts || !lengths || !out) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    for (; acquired < num_texts; acquired++) {
+        Py_buffer* view = &views[acquired];
+        if (getInputBuffer(PySequence_Fast_GET_ITEM(seq, acquired), view) != 0) goto done;
+        if (view->len > INT_MAX) {
+            PyBuffer_Release(view);
+            PyErr_SetString(PyExc_OverflowError, "input too large");
+            goto done;
+        }
+        texts[acquired] = (const char*)view->buf;
+        lengths[acquired] = (int)view->len;
+    }
+
+    if (!self->pool) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        self->pool = createThreadPool(cpus > 0 ? (int)cpus : 1);
+    }
+    Py_BEGIN_ALLOW_THREADS
+    encodeBatch(tokenizer, self->pool, texts, lengths, (int)num_texts, out);
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(num_texts);
+    for (Py_ssize_t i = 0; i < num_texts; i++) {
+        PyObject* ids = result ? newTokenIds(out[i].ids, out[i].num_ids) : NULL;
+        if (!ids) {
+            if (!result) free(out[i].ids);
+            Py_CLEAR(result);
+            continue;
+        }
+        PyList_SET_ITEM(result, i, ids);
+    }
+
+done:
+    for (Py_ssize_t i = 0; i < acquired; i++) {
+        PyBuffer_Release(&views[i]);
+    }
+    PyMem_Free(views);
+    PyMem_Free(texts);
+    PyMem_Free(lengths);
+    PyMem_Free(out);
+    Py_DECREF(seq);
+    return result;
+}
+
+static PyMethodDef Tokenizer_methods[] = {
+    {"encode", (PyCFunction)Tokenizer_encode, METH_O,
+     "encode(data) -> TokenIds\n\nEncode a bytes-like object (or str as UTF-8)."},
+    {"decode", (PyCFunction)Tokenizer_decode, METH_O,
+     "decode(ids) -> bytes\n\nDecode a buffer of int32 ids or a sequence of ints."},
+    {"encode_batch", (PyCFunction)Tokenizer_encode_batch, METH_O,
+     "encode_batch(texts) -> list[TokenIds]\n\nEncode many inputs on the native thread pool."},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject TokenizerType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "rwkv_tokenizer.Tokenizer",
+    .tp_basicsize = sizeof(TokenizerObject),
+    .tp_dealloc = (destructor)Tokenizer_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Tokenizer(vocab_path='rwkv_vocab_v20230424.txt')",
+    .tp_methods = Tokenizer_methods,
+    .tp_init = (initproc)Tokenizer_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef rwkv_tokenizer_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "rwkv_tokenizer",
+    .m_doc = "RWKV world tokenizer.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_rwkv_tokenizer(void) {
+    if (PyType_Ready(&TokenIdsType) < 0 || PyType_Ready(&TokenizerType) < 0) {
+        return NULL;
+    }
+    PyObject* module = PyModule_Create(&rwkv_tokenizer_module);
+    if (!module) return NULL;
+    Py_INCREF(&TokenIdsType);
+    Py_INCREF(&TokenizerType);
+    if (PyModule_AddObject(module, "TokenIds", (PyObject*)&TokenIdsType) < 0 ||
+        PyModule_AddObject(module, "Tokenizer", (PyObject*)&TokenizerType) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
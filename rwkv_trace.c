@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "rwkv_trace.h"
+
+#define TRACE_BUFFER_EVENTS (1 << 16)
+
+typedef struct {
+    uint64_t timestamp_ns;
+    unsigned char stage;
+    char phase;
+} TraceRecord;
+
+// Only the owning thread writes to a buffer. Buffers are pushed onto a
+// lock-free list on first use and never freed, so the dump can walk them.
+typedef struct TraceBuffer {
+    struct TraceBuffer* next;
+    int tid;
+    char name[32];
+    atomic_int count;
+    int dropped;
+    TraceRecord records[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+bool rwkv_trace_enabled = false;
+
+static _Atomic(TraceBuffer*) trace_buffers;
+static atomic_int trace_next_tid;
+static _Thread_local TraceBuffer* trace_local;
+
+static const char* stage_names[NUM_TRACE_STAGES] = {"load_vocab", "read", "encode", "reorder", "write"};
+
+static uint64_t traceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void traceEnable(void) {
+    rwkv_trace_enabled = true;
+}
+
+static TraceBuffer* traceLocalBuffer(void) {
+    if (trace_local) return trace_local;
+    TraceBuffer* buffer = (TraceBuffer*)calloc(1, sizeof(TraceBuffer));
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    buffer->tid = atomic_fetch_add(&trace_next_tid, 1) + 1;
+    snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->tid);
+    TraceBuffer* head = atomic_load_explicit(&trace_buffers, memory_order_relaxed);
+    do {
+        buffer->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&trace_buffers, &head, buffer,
+                                                    memory_order_release, memory_order_relaxed));
+    trace_local = buffer;
+    return buffer;
+}
+
+void traceEvent(TraceStage stage, char phase) {
+    TraceBuffer* buffer = traceLocalBuffer();
+    int count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    if (count == TRACE_BUFFER_EVENTS) {
+        buffer->dropped++;
+        return;
+    }
+    buffer->records[count].timestamp_ns = traceNow();
+    buffer->records[count].stage = (unsigned char)stage;
+    buffer->records[count].phase = phase;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+void traceThreadName(const char* name) {
+    TraceBuffer* buffer = traceLocalBuffer();
+    snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+int traceDump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open trace file: %s\n", path);
+        return -1;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    int dropped = 0;
+    for (TraceBuffer* buffer = atomic_load_explicit(&trace_buffers, memory_order_acquire); buffer; buffer = buffer->next) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->tid, buffer->name);
+        first = false;
+        int count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+        for (int i = 0; i < count; i++) {
+            const TraceRecord* record = &buffer->records[i];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                    stage_names[record->stage], record->phase, record->timestamp_ns / 1000.0, buffer->tid);
+        }
+        dropped += buffer->dropped;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    if (dropped > 0) {
+        fprintf(stderr, "Trace buffers full, dropped %d events\n", dropped);
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef RWKV_TRACE_H
+#define RWKV_TRACE_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Begin/end events per pipeline stage, recorded into per-thread buffers and
+// dumped as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// When tracing is off every TRACE_* macro is a single well-predicted branch.
+typedef enum {
+    TRACE_LOAD_VOCAB,  // startup, kept apart from the input reads
+    TRACE_READ,
+    TRACE_ENCODE,
+    TRACE_REORDER,
+    TRACE_WRITE,
+    NUM_TRACE_STAGES
+} TraceStage;
+
+extern bool rwkv_trace_enabled;
+
+// Call before starting the threads to be traced.
+void traceEnable(void);
+void traceEvent(TraceStage stage, char phase);
+// Names the calling thread's track in the trace.
+void traceThreadName(const char* name);
+// Writes everything recorded so far; call after traced threads are done.
+int traceDump(const char* path);
+
+#define TRACE_BEGIN(stage) do { if (__builtin_expect(rwkv_trace_enabled, 0)) traceEvent(stage, 'B'); } while (0)
+#define TRACE_END(stage) do { if (__builtin_expect(rwkv_trace_enabled, 0)) traceEvent(stage, 'E'); } while (0)
+#define TRACE_THREAD_NAME(name) do { if (__builtin_expect(rwkv_trace_enabled, 0)) traceThreadName(name); } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef RWKV_WIRE_H
+#define RWKV_WIRE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// rwkv_server and rwkv_http send lengths, counts and token ids as
+// little-endian uint32. Token ids are non-negative ints, so on a
+// little-endian host an id array already has that layout and goes to and
+// from the socket without conversion. Other hosts fail to compile rather
+// than send byte-swapped ids.
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the uint32 wire format is only implemented for little-endian hosts"
+#endif
+_Static_assert(sizeof(int) == sizeof(uint32_t), "token ids are sent as uint32");
+
+// An id array as wire bytes, without copying.
+static inline const void* idsToWire(const int* ids) {
+    return ids;
+}
+
+static inline void idsFromWire(int* ids, const void* data, int count) {
+    memcpy(ids, data, (size_t)count * sizeof(uint32_t));
+}
+
+#endif
@@ -0,0 +1,15 @@
+from setuptools import setup, Extension
+
+setup(
+    name="rwkv_tokenizer",
+    version="0.1.0",
+    ext_modules=[
+        Extension(
+            "rwkv_tokenizer",
+            sources=["rwkv_tokenizer_py.c", "rwkv_tokenizer.c"],
+            define_macros=[("RWKV_TOKENIZER_NO_MAIN", None)],
+            extra_compile_args=["-O3", "-pthread"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)